@@ -1,12 +1,17 @@
 import argparse
 import gzip
 import io  # noqa: F401 used in timeit strings
+import json
+import os
+import random
+import time
 import timeit
 import zlib
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
-from typing import Dict
+from typing import Callable, Dict
 
-from isal import igzip, isal_zlib  # noqa: F401 used in timeit strings
+from isal import igzip, igzip_lib, isal_zlib  # noqa: F401 used in timeit strings
 
 DATA_DIR = Path(__file__).parent / "tests" / "data"
 COMPRESSED_FILE = DATA_DIR / "test.fastq.gz"
@@ -75,6 +80,161 @@ def benchmark(name: str,
                                           ratio))
 
 
+def benchmark_threads(name: str,
+                      isal_function: Callable[[bytes], bytes],
+                      zlib_function: Callable[[bytes], bytes],
+                      data_block: bytes,
+                      number: int = 20):
+    """Run the functions on independent data in an increasing number of
+    threads. Each thread does the same amount of work, so perfect scaling
+    results in a speedup equal to the number of threads."""
+    print(name)
+    print("threads\tisal MB/s\tisal speedup\tzlib MB/s\tzlib speedup")
+    thread_counts = [1]
+    while thread_counts[-1] * 2 <= (os.cpu_count() or 1):
+        thread_counts.append(thread_counts[-1] * 2)
+    base_speeds = {}
+    for threads in thread_counts:
+        results = []
+        for label, function in (("isal", isal_function),
+                                ("zlib", zlib_function)):
+            with ThreadPoolExecutor(threads) as executor:
+                start = time.perf_counter()
+                # Exhaust the iterator so all work is done.
+                for _ in executor.map(function,
+                                      [data_block] * (threads * number)):
+                    pass
+                elapsed = time.perf_counter() - start
+            speed = len(data_block) * threads * number / elapsed / 1_000_000
+            base_speeds.setdefault(label, speed)
+            results.append(round(speed, 1))
+            results.append(round(speed / base_speeds[label], 2))
+        print("{0}\t{1}\t{2}\t{3}\t{4}".format(threads, *results))
+
+
+def benchmark_mem_levels(level: int = 1):
+    """Show the latency and throughput of one-shot compression for each
+    memory level over a range of input sizes."""
+    mem_levels = {
+        "min": igzip_lib.MEM_LEVEL_MIN,
+        "small": igzip_lib.MEM_LEVEL_SMALL,
+        "medium": igzip_lib.MEM_LEVEL_MEDIUM,
+        "large": igzip_lib.MEM_LEVEL_LARGE,
+        "xlarge": igzip_lib.MEM_LEVEL_EXTRA_LARGE,
+        "auto": igzip_lib.MEM_LEVEL_AUTO,
+    }
+    print("igzip_lib compression level {0} by memory level".format(level))
+    print("microseconds per call (MB/s)")
+    print("size\t" + "\t".join(mem_levels))
+    size = 128
+    while size <= len(data):
+        data_block = data[:size]
+        # Aim for roughly 100 MB of input per measurement.
+        number = max(100_000_000 // size // 10, 3)
+        results = []
+        for mem_level in mem_levels.values():
+            elapsed = timeit.timeit(
+                lambda: igzip_lib.compress(data_block, level,
+                                           mem_level=mem_level),
+                number=number)
+            results.append("{0} ({1})".format(
+                round(elapsed * 1_000_000 / number, 2),
+                round(size * number / elapsed / 1_000_000)))
+        print("{0}\t{1}".format(size, "\t".join(results)))
+        size *= 4
+
+
+def benchmark_level_buf_cache():
+    """Show the latency of one-shot compression with the cached level buffer
+    and with a new level buffer for every call."""
+    print("igzip_lib compression with and without the level buffer cache")
+    print("microseconds per call")
+    print("size\tlevel\tcached\tuncached")
+    for size in (128, 1024, 8 * 1024, 64 * 1024):
+        data_block = data[:size]
+        number = max(10_000_000 // size, 100)
+        for level in range(4):
+            cached = timeit.timeit(
+                lambda: igzip_lib.compress(data_block, level), number=number)
+
+            def uncached():
+                # Empty the cache so the call has to allocate a buffer.
+                igzip_lib._level_buf_cache.buffer = None
+                igzip_lib.compress(data_block, level)
+            uncached_time = timeit.timeit(uncached, number=number)
+            print("{0}\t{1}\t{2}\t{3}".format(
+                size, level, round(cached * 1_000_000 / number, 2),
+                round(uncached_time * 1_000_000 / number, 2)))
+
+
+def json_events(number: int, seed: int = 0):
+    """Create JSON events of roughly 1 KiB with a fixed layout."""
+    rng = random.Random(seed)
+    events = []
+    for _ in range(number):
+        event = {
+            "timestamp": "2024-05-{0:02d}T{1:02d}:{2:02d}:{3:02d}Z".format(
+                rng.randint(1, 28), rng.randint(0, 23), rng.randint(0, 59),
+                rng.randint(0, 59)),
+            "event": rng.choice(["page_view", "click", "purchase", "signup"]),
+            "user": {
+                "id": rng.randint(1, 1_000_000),
+                "country": rng.choice(["NL", "US", "DE", "JP"]),
+                "agent": rng.choice([
+                    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36",
+                    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) Gecko/20100101 "
+                    "Firefox/115.0"]),
+            },
+            "properties": {
+                "path": "/products/{0}".format(rng.randint(1, 500)),
+                "referrer": rng.choice(["https://www.example.com/",
+                                        "https://search.example.org/?q=shoes",
+                                        ""]),
+                "items": [{"sku": "SKU-{0:05d}".format(rng.randint(0, 99999)),
+                           "price": round(rng.random() * 100, 2),
+                           "quantity": rng.randint(1, 3)}
+                          for _ in range(rng.randint(8, 14))],
+            },
+            "session": "{0:032x}".format(rng.getrandbits(128)),
+        }
+        events.append(json.dumps(event).encode())
+    return events
+
+
+def benchmark_dict(level: int = 1):
+    """Show the compression ratio and throughput of small messages with and
+    without a dictionary made by isal_zlib.train_dict."""
+    events = json_events(4000)
+    samples, messages = events[:2000], events[2000:]
+    start = time.perf_counter()
+    zdict = isal_zlib.train_dict(samples)
+    print("Trained a {0} byte dictionary from {1} samples in {2} s".format(
+        len(zdict), len(samples), round(time.perf_counter() - start, 2)))
+    prepared = isal_zlib.PreparedDict(zdict, level)
+    dictionaries = {"none": None, "zdict": zdict, "prepared": prepared}
+    total = sum(len(message) for message in messages)
+    print("{0} messages of {1} bytes on average, level {2}".format(
+        len(messages), total // len(messages), level))
+    print("dict\tratio\tMB/s")
+    for name, dictionary in dictionaries.items():
+        def compress_all():
+            compressed_size = 0
+            for message in messages:
+                if dictionary is None:
+                    compressobj = isal_zlib.compressobj(level, wbits=-15)
+                else:
+                    compressobj = isal_zlib.compressobj(level, wbits=-15,
+                                                        zdict=dictionary)
+                compressed_size += len(compressobj.compress(message) +
+                                       compressobj.flush())
+            return compressed_size
+        number = 10
+        elapsed = timeit.timeit(compress_all, number=number)
+        print("{0}\t{1}\t{2}".format(
+            name, round(total / compress_all(), 2),
+            round(total * number / elapsed / 1_000_000, 1)))
+
+
 # show_sizes()
 
 def argument_parser() -> argparse.ArgumentParser:
@@ -85,6 +245,11 @@ def argument_parser() -> argparse.ArgumentParser:
     parser.add_argument("--gzip", action="store_true")
     parser.add_argument("--sizes", action="store_true")
     parser.add_argument("--objects", action="store_true")
+    parser.add_argument("--threads", action="store_true")
+    parser.add_argument("--mem-levels", action="store_true")
+    parser.add_argument("--level-buf-cache", action="store_true")
+    parser.add_argument("--batch", action="store_true")
+    parser.add_argument("--dict", action="store_true")
     return parser
 
 
@@ -103,6 +268,12 @@ if __name__ == "__main__":
                   "isal_zlib.compress(data_block, 1)",
                   "zlib.compress(data_block, 1)")
 
+        # Level 3 uses the largest level buffer. This shows the cost of
+        # per-call state setup for small inputs.
+        benchmark("zlib compression level 3", sizes,
+                  "isal_zlib.compress(data_block, 3)",
+                  "zlib.compress(data_block, 9)")
+
         benchmark("zlib decompression", compressed_sizes,
                   "isal_zlib.decompress(data_block)",
                   "zlib.decompress(data_block)")
@@ -130,3 +301,40 @@ if __name__ == "__main__":
                   "a = gzip.GzipFile(fileobj=io.BytesIO(), mode='rb')")
     if args.sizes or args.all:
         show_sizes()
+    if args.mem_levels or args.all:
+        benchmark_mem_levels()
+    if args.level_buf_cache or args.all:
+        benchmark_level_buf_cache()
+    if args.batch or args.all:
+        # The zlib column shows a loop of single isal_zlib calls here.
+        records = {"1000x{0}b".format(size): [data[i:i + size] for i in
+                                             range(0, 1000 * size, size)]
+                   for size in (64, 256, 1024)}
+        benchmark("batch compression", records,
+                  "igzip_lib.compress_many(data_block, 1)",
+                  "[isal_zlib.compress(x, 1, -15) for x in data_block]",
+                  number=100)
+        benchmark("batch crc32", records,
+                  "isal_zlib.crc32_many(data_block)",
+                  "[isal_zlib.crc32(x) for x in data_block]",
+                  number=1000)
+    if args.dict or args.all:
+        benchmark_dict()
+    if args.threads or args.all:
+        benchmark_threads("threaded zlib compression",
+                          lambda x: isal_zlib.compress(x, 1),
+                          lambda x: zlib.compress(x, 1),
+                          data)
+        benchmark_threads("threaded zlib decompression",
+                          isal_zlib.decompress,
+                          zlib.decompress,
+                          zlib.compress(data, 1))
+        benchmark_threads("threaded igzip decompression",
+                          igzip.decompress,
+                          gzip.decompress,
+                          gzip.compress(data, 1))
+        benchmark_threads("threaded crc32",
+                          isal_zlib.crc32,
+                          zlib.crc32,
+                          data,
+                          number=200)
@@ -0,0 +1,576 @@
+# Copyright (c) 2020 Leiden University Medical Center
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Reading and writing of BGZF files, the blocked gzip format used by bgzip
+and htslib.
+
+A BGZF file is a series of gzip members of at most 64K each. Every member
+has a ``BC`` extra field that stores its compressed size. The file ends with
+an empty member. Since the blocks are independent they can be compressed
+and decompressed on multiple threads. Positions in a BGZF file are given as
+virtual offsets: the compressed offset of a block shifted left by 16 bits,
+combined with the offset within the uncompressed block.
+"""
+
+import bisect
+import builtins
+import collections
+import io
+import struct
+from concurrent.futures import ThreadPoolExecutor
+from typing import List, Tuple
+
+from . import igzip_lib, isal_zlib
+from .igzip import BadGzipFile
+
+__all__ = ["BgzfReader", "BgzfWriter", "open", "read_gzi",
+           "make_virtual_offset", "split_virtual_offset", "BGZF_BLOCK_SIZE",
+           "BGZF_EOF"]
+
+#: The amount of uncompressed data in a block. Same as bgzip. This leaves
+#: room for the compressed data to be slightly larger than the input.
+BGZF_BLOCK_SIZE = 0xff00
+
+# The maximum size of a complete block, including header and trailer.
+_BGZF_MAX_BLOCK_SIZE = 0x10000
+
+# Magic, method, flags (FEXTRA), mtime, xfl, os (255 for unknown OS), xlen,
+# the B and C subfield identifiers, subfield length and BSIZE, the total
+# block size minus one.
+_BGZF_HEADER = struct.Struct("<BBBBIBBHBBHH")
+_BGZF_HEADER_SIZE = _BGZF_HEADER.size
+_BGZF_TRAILER_SIZE = 8
+
+#: The empty block that marks the end of a BGZF file.
+BGZF_EOF = (b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00"
+            b"\x1b\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00")
+
+
+def make_virtual_offset(block_offset, within_block_offset):
+    """Combine the compressed offset of a block and an offset in its
+    uncompressed data into a virtual offset."""
+    if not 0 <= within_block_offset < 0x10000:
+        raise ValueError("within_block_offset must be in range(65536), "
+                         "got {0}".format(within_block_offset))
+    if not 0 <= block_offset < 1 << 48:
+        raise ValueError("block_offset must be in range(2 ** 48), "
+                         "got {0}".format(block_offset))
+    return (block_offset << 16) | within_block_offset
+
+
+def split_virtual_offset(virtual_offset):
+    """Split a virtual offset into the compressed offset of a block and the
+    offset in its uncompressed data."""
+    return virtual_offset >> 16, virtual_offset & 0xFFFF
+
+
+def _compress_block(data, compresslevel):
+    """Compress data into a complete BGZF block."""
+    # Deflate data followed by the gzip trailer.
+    compressed = igzip_lib.compress(data, compresslevel,
+                                    flag=igzip_lib.COMP_GZIP_NO_HDR)
+    if (len(compressed) + _BGZF_HEADER_SIZE) > _BGZF_MAX_BLOCK_SIZE:
+        # Incompressible data. Store it in a single stored deflate block.
+        length = len(data)
+        compressed = b"".join([
+            struct.pack("<BHH", 1, length, length ^ 0xFFFF), data,
+            struct.pack("<II", isal_zlib.crc32(data), length)])
+    block_size = _BGZF_HEADER_SIZE + len(compressed)
+    header = _BGZF_HEADER.pack(0x1f, 0x8b, 8, 4, 0, 0, 255, 6,
+                               ord("B"), ord("C"), 2, block_size - 1)
+    return header + compressed
+
+
+def _decompress_block(block):
+    """Decompress a complete BGZF block. A wrong CRC or size in the trailer
+    raises BadGzipFile, as in igzip."""
+    return igzip_lib.decompress_gzip(block)
+
+
+def _read_block(fileobj):
+    """Read the next complete BGZF block from fileobj. Returns an empty bytes
+    object at the end of the file."""
+    header = fileobj.read(12)
+    if not header:
+        return b""
+    if len(header) < 12:
+        raise EOFError("Compressed file ended before the end of the block "
+                       "header was reached")
+    magic, method, flags, xlen = struct.unpack("<HBB6xH", header)
+    if magic != 0x8b1f:
+        raise BadGzipFile("Not a gzipped file (%r)" % header[:2])
+    if method != 8:
+        raise BadGzipFile("Unknown compression method")
+    if not flags & 4:
+        raise BadGzipFile("Not a BGZF file, the extra field is missing")
+    extra = fileobj.read(xlen)
+    if len(extra) < xlen:
+        raise EOFError("Compressed file ended before the end of the block "
+                       "header was reached")
+    pos = 0
+    block_size = None
+    # The BC subfield does not need to be the only one.
+    while pos + 4 <= xlen:
+        si1, si2, slen = struct.unpack_from("<BBH", extra, pos)
+        if si1 == ord("B") and si2 == ord("C") and slen == 2:
+            block_size = struct.unpack_from("<H", extra, pos + 4)[0] + 1
+            break
+        pos += 4 + slen
+    if block_size is None:
+        raise BadGzipFile("Not a BGZF file, the BC extra field is missing")
+    remaining = block_size - len(header) - xlen
+    if remaining < _BGZF_TRAILER_SIZE:
+        raise BadGzipFile("Invalid BGZF block size: %d" % block_size)
+    rest = fileobj.read(remaining)
+    if len(rest) < remaining:
+        raise EOFError("Compressed file ended before the end of the block "
+                       "was reached")
+    return header + extra + rest
+
+
+def read_gzi(filename) -> List[Tuple[int, int]]:
+    """Read a .gzi index as written by ``bgzip --index`` or
+    :py:meth:`BgzfWriter.write_gzi`. Returns a list of (compressed offset,
+    uncompressed offset) tuples for the starts of the blocks, including the
+    first block at (0, 0)."""
+    with builtins.open(filename, "rb") as gzi_file:
+        data = gzi_file.read()
+    if len(data) < 8:
+        raise ValueError("Not a gzi index")
+    number, = struct.unpack_from("<Q", data)
+    if len(data) != 8 + 16 * number:
+        raise ValueError("Not a gzi index, expected {0} entries".format(
+            number))
+    entries = [(0, 0)]
+    entries.extend(struct.iter_unpack("<QQ", data[8:]))
+    return entries
+
+
+class BgzfWriter(io.BufferedIOBase):
+    """Write a BGZF file.
+
+    The data is cut into blocks of BGZF_BLOCK_SIZE bytes. With threads larger
+    than 1 the blocks are compressed on multiple threads. The written file can
+    be read by any gzip reader.
+    """
+    def __init__(self, filename=None, mode="wb",
+                 compresslevel=isal_zlib.ISAL_DEFAULT_COMPRESSION,
+                 fileobj=None, threads=1):
+        """
+        Either filename or fileobj must be given. mode can be 'wb', 'ab' or
+        'xb'. threads is the number of threads used for compression.
+        """
+        if mode not in ("w", "wb", "a", "ab", "x", "xb"):
+            raise ValueError("Invalid mode: {0!r}".format(mode))
+        if not (isal_zlib.ISAL_BEST_SPEED <= compresslevel
+                <= isal_zlib.ISAL_BEST_COMPRESSION):
+            raise ValueError(
+                "Compression level should be between {0} and {1}.".format(
+                    isal_zlib.ISAL_BEST_SPEED, isal_zlib.ISAL_BEST_COMPRESSION
+                ))
+        if threads < 1:
+            raise ValueError("threads must be at least 1")
+        if fileobj is None:
+            if filename is None:
+                raise ValueError("Either filename or fileobj must be given")
+            fileobj = builtins.open(filename, mode if "b" in mode
+                                    else mode + "b")
+            self._myfileobj = fileobj
+        else:
+            self._myfileobj = None
+        self._fileobj = fileobj
+        self._compresslevel = compresslevel
+        self._threads = threads
+        self._executor = ThreadPoolExecutor(threads) if threads > 1 else None
+        self._pending = bytearray()
+        self._results = collections.deque()
+        # Appending starts at the current end of the file.
+        self._compressed_offset = fileobj.tell() if "a" in mode else 0
+        # The uncompressed size of the existing blocks is not known, so the
+        # uncompressed offsets of the appended blocks are not either.
+        self._appended = self._compressed_offset > 0
+        self._uncompressed_offset = 0
+        self._gzi_entries = []
+
+    @property
+    def closed(self):
+        return self._fileobj is None
+
+    def writable(self):
+        return True
+
+    def _submit_block(self, block):
+        if self._executor is None:
+            self._write_block(_compress_block(block, self._compresslevel),
+                              len(block))
+            return
+        self._results.append((self._executor.submit(
+            _compress_block, block, self._compresslevel), len(block)))
+        # Limit the amount of data that is in flight. Finished blocks are
+        # written immediately, in order.
+        while len(self._results) > 2 * self._threads:
+            self._write_result()
+        while self._results and self._results[0][0].done():
+            self._write_result()
+
+    def _write_result(self):
+        future, length = self._results.popleft()
+        self._write_block(future.result(), length)
+
+    def _write_block(self, compressed, length):
+        self._fileobj.write(compressed)
+        self._compressed_offset += len(compressed)
+        self._uncompressed_offset += length
+        self._gzi_entries.append((self._compressed_offset,
+                                  self._uncompressed_offset))
+
+    def _check_not_closed(self):
+        if self._fileobj is None:
+            raise ValueError("I/O operation on closed BgzfWriter object")
+
+    def write(self, data):
+        self._check_not_closed()
+        # accept any data that supports the buffer protocol
+        data = memoryview(data).cast("B")
+        length = data.nbytes
+        if self._pending:
+            needed = BGZF_BLOCK_SIZE - len(self._pending)
+            self._pending += data[:needed]
+            data = data[needed:]
+            if len(self._pending) == BGZF_BLOCK_SIZE:
+                self._submit_block(bytes(self._pending))
+                self._pending = bytearray()
+        while len(data) >= BGZF_BLOCK_SIZE:
+            self._submit_block(bytes(data[:BGZF_BLOCK_SIZE]))
+            data = data[BGZF_BLOCK_SIZE:]
+        self._pending += data
+        return length
+
+    def tell(self):
+        """Return the virtual offset of the next byte that is written. This
+        waits until all blocks before it have been compressed."""
+        self._check_not_closed()
+        while self._results:
+            self._write_result()
+        return make_virtual_offset(self._compressed_offset,
+                                   len(self._pending))
+
+    def flush(self):
+        """Write any pending data as a block, so the data written so far can
+        be read back. This ends the current block early."""
+        self._check_not_closed()
+        if self._pending:
+            self._submit_block(bytes(self._pending))
+            self._pending = bytearray()
+        while self._results:
+            self._write_result()
+        self._fileobj.flush()
+
+    def close(self):
+        """Write all data and the end of file marker and close the file."""
+        if self._fileobj is None:
+            return
+        try:
+            self.flush()
+            self._fileobj.write(BGZF_EOF)
+            self._fileobj.flush()
+        finally:
+            self._fileobj = None
+            if self._executor is not None:
+                self._executor.shutdown()
+            if self._myfileobj is not None:
+                self._myfileobj.close()
+                self._myfileobj = None
+
+    def write_gzi(self, filename):
+        """Write a .gzi index of the blocks written so far, in the same
+        format as ``bgzip --index``. The index allows seeking to uncompressed
+        offsets with :py:meth:`BgzfReader.seek_uncompressed`.
+
+        This is not supported when appending to an existing file. Run
+        ``bgzip --reindex`` on the complete file instead."""
+        if self._appended:
+            raise ValueError("A gzi index can not be written when appending "
+                             "to an existing file")
+        with builtins.open(filename, "wb") as gzi_file:
+            gzi_file.write(struct.pack("<Q", len(self._gzi_entries)))
+            for compressed_offset, uncompressed_offset in self._gzi_entries:
+                gzi_file.write(struct.pack("<QQ", compressed_offset,
+                                           uncompressed_offset))
+
+
+class BgzfReader(io.BufferedIOBase):
+    """Read a BGZF file.
+
+    With threads larger than 1 the blocks after the current one are read
+    ahead and decompressed on multiple threads. tell() and seek() work with
+    virtual offsets.
+    """
+    def __init__(self, filename=None, fileobj=None, threads=1, gzi=None):
+        """
+        Either filename or fileobj must be given. threads is the number of
+        threads used for decompression. gzi can be the filename of a .gzi
+        index or a list returned by read_gzi. It is needed for
+        seek_uncompressed.
+        """
+        if threads < 1:
+            raise ValueError("threads must be at least 1")
+        if fileobj is None:
+            if filename is None:
+                raise ValueError("Either filename or fileobj must be given")
+            fileobj = builtins.open(filename, "rb")
+            self._myfileobj = fileobj
+        else:
+            self._myfileobj = None
+        self._fileobj = fileobj
+        self._threads = threads
+        self._executor = ThreadPoolExecutor(threads) if threads > 1 else None
+        self._results = collections.deque()
+        # Compressed offset of the next block that is read from the file.
+        # Pipes, such as stdin, can not tell their position. The offsets
+        # then count from where reading started.
+        self._next_block_offset = fileobj.tell() if fileobj.seekable() else 0
+        self._block_offset = self._next_block_offset
+        self._block = b""
+        self._within_block = 0
+        if gzi is not None and not isinstance(gzi, list):
+            gzi = read_gzi(gzi)
+        self._gzi = gzi
+
+    @property
+    def closed(self):
+        return self._fileobj is None
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return self._fileobj.seekable()
+
+    def _check_not_closed(self):
+        if self._fileobj is None:
+            raise ValueError("I/O operation on closed BgzfReader object")
+
+    def _check_can_seek(self):
+        if not self._fileobj.seekable():
+            raise io.UnsupportedOperation("The underlying file object does "
+                                          "not support seeking")
+
+    def _read_raw_block(self):
+        offset = self._next_block_offset
+        block = _read_block(self._fileobj)
+        self._next_block_offset += len(block)
+        return offset, block
+
+    def _load_next_block(self):
+        """Make the next block with data the current block. Returns False at
+        the end of the file."""
+        while True:
+            if self._executor is None:
+                offset, block = self._read_raw_block()
+                if not block:
+                    return False
+                data = _decompress_block(block)
+            else:
+                # Keep the pool busy with the blocks that follow.
+                while len(self._results) < 2 * self._threads:
+                    offset, block = self._read_raw_block()
+                    if not block:
+                        break
+                    self._results.append((offset, self._executor.submit(
+                        _decompress_block, block)))
+                if not self._results:
+                    return False
+                offset, future = self._results.popleft()
+                data = future.result()
+            self._block_offset = offset
+            self._block = data
+            self._within_block = 0
+            # Skip empty blocks such as the end of file marker.
+            if data:
+                return True
+
+    def read(self, size=-1):
+        self._check_not_closed()
+        if size is None or size < 0:
+            parts = [self._block[self._within_block:]]
+            self._within_block = len(self._block)
+            while self._load_next_block():
+                parts.append(self._block)
+                self._within_block = len(self._block)
+            return b"".join(parts)
+        parts = []
+        while size > 0:
+            if self._within_block == len(self._block):
+                if not self._load_next_block():
+                    break
+            data = self._block[self._within_block:self._within_block + size]
+            self._within_block += len(data)
+            size -= len(data)
+            parts.append(data)
+        return b"".join(parts)
+
+    def read1(self, size=-1):
+        self._check_not_closed()
+        if self._within_block == len(self._block):
+            if not self._load_next_block():
+                return b""
+        if size is None or size < 0:
+            size = len(self._block)
+        data = self._block[self._within_block:self._within_block + size]
+        self._within_block += len(data)
+        return data
+
+    def readinto(self, b):
+        with memoryview(b) as view, view.cast("B") as byte_view:
+            data = self.read(len(byte_view))
+            byte_view[:len(data)] = data
+            return len(data)
+
+    def readline(self, size=-1):
+        self._check_not_closed()
+        parts = []
+        while size != 0:
+            if self._within_block == len(self._block):
+                if not self._load_next_block():
+                    break
+            end = self._block.find(b"\n", self._within_block) + 1
+            if end == 0:
+                end = len(self._block)
+            if 0 < size < end - self._within_block:
+                end = self._within_block + size
+            data = self._block[self._within_block:end]
+            self._within_block = end
+            parts.append(data)
+            size -= len(data)
+            if data.endswith(b"\n"):
+                break
+        return b"".join(parts)
+
+    def tell(self):
+        """Return the virtual offset of the next byte that is read."""
+        self._check_not_closed()
+        return make_virtual_offset(self._block_offset, self._within_block)
+
+    def seek(self, virtual_offset, whence=io.SEEK_SET):
+        """Go to a virtual offset as returned by tell() or
+        BgzfWriter.tell()."""
+        self._check_not_closed()
+        self._check_can_seek()
+        if whence != io.SEEK_SET:
+            raise ValueError("Only seeking to virtual offsets is supported")
+        block_offset, within_block = split_virtual_offset(virtual_offset)
+        if block_offset != self._block_offset or not self._block:
+            for _, future in self._results:
+                future.cancel()
+            self._results.clear()
+            self._fileobj.seek(block_offset)
+            self._next_block_offset = block_offset
+            self._block = b""
+            self._within_block = 0
+            if not self._load_next_block():
+                if within_block:
+                    raise ValueError("Virtual offset is beyond the end of "
+                                     "the file")
+                return virtual_offset
+            if self._block_offset != block_offset:
+                # The offset pointed at an empty block.
+                if within_block:
+                    raise ValueError("Virtual offset is beyond the end of "
+                                     "the block")
+                return self.tell()
+        if within_block > len(self._block):
+            raise ValueError("Virtual offset is beyond the end of the block")
+        self._within_block = within_block
+        return virtual_offset
+
+    def seek_uncompressed(self, offset):
+        """Go to an offset in the uncompressed data. This requires a .gzi
+        index. Returns the virtual offset."""
+        self._check_not_closed()
+        self._check_can_seek()
+        if self._gzi is None:
+            raise ValueError("A gzi index is required to seek to uncompressed "
+                             "offsets")
+        uncompressed_starts = [entry[1] for entry in self._gzi]
+        i = bisect.bisect_right(uncompressed_starts, offset) - 1
+        block_offset, block_start = self._gzi[i]
+        self.seek(make_virtual_offset(block_offset, 0))
+        # The index does not record block sizes, so read forward.
+        self.read(offset - block_start)
+        return self.tell()
+
+    def close(self):
+        if self._fileobj is None:
+            return
+        try:
+            if self._executor is not None:
+                for _, future in self._results:
+                    future.cancel()
+                self._executor.shutdown()
+            if self._myfileobj is not None:
+                self._myfileobj.close()
+                self._myfileobj = None
+        finally:
+            self._fileobj = None
+            self._results.clear()
+
+
+def open(filename, mode="rb", compresslevel=isal_zlib.ISAL_DEFAULT_COMPRESSION,
+         encoding=None, errors=None, newline=None, threads=1):
+    """Open a BGZF file in binary or text mode.
+
+    The filename argument can be an actual filename (a str or bytes object),
+    or an existing file object to read from or write to.
+
+    The mode argument can be "r", "rb", "w", "wb", "x", "xb", "a" or "ab" for
+    binary mode, or "rt", "wt", "xt" or "at" for text mode. Returns a
+    BgzfReader or BgzfWriter, wrapped in an io.TextIOWrapper in text mode.
+
+    threads is the number of threads used for compression or decompression.
+    """
+    if "t" in mode:
+        if "b" in mode:
+            raise ValueError("Invalid mode: %r" % (mode,))
+    else:
+        if encoding is not None:
+            raise ValueError(
+                "Argument 'encoding' not supported in binary mode")
+        if errors is not None:
+            raise ValueError("Argument 'errors' not supported in binary mode")
+        if newline is not None:
+            raise ValueError("Argument 'newline' not supported in binary mode")
+
+    bgzf_mode = mode.replace("t", "")
+    if isinstance(filename, (str, bytes)) or hasattr(filename, "__fspath__"):
+        file_args = dict(filename=filename)
+    elif hasattr(filename, "read") or hasattr(filename, "write"):
+        file_args = dict(fileobj=filename)
+    else:
+        raise TypeError("filename must be a str or bytes object, or a file")
+    if "r" in bgzf_mode:
+        binary_file = BgzfReader(threads=threads, **file_args)
+    else:
+        binary_file = BgzfWriter(mode=bgzf_mode, compresslevel=compresslevel,
+                                 threads=threads, **file_args)
+
+    if "t" in mode:
+        return io.TextIOWrapper(binary_file, encoding, errors, newline)
+    return binary_file
@@ -20,7 +20,7 @@
 
 # cython: language_level=3
 
-cdef extern from "<isa-l/crc.h>":
+cdef extern from "<isa-l/crc.h>" nogil:
     cdef unsigned int crc32_gzip_refl(
     unsigned int init_crc,          #!< initial CRC value, 32 bits
     const unsigned char *buf, #!< buffer to calculate CRC on
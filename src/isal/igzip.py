@@ -22,19 +22,26 @@
 Library to speed up its methods."""
 
 import argparse
+import bisect
+import collections
+import functools
 import gzip
 import io
 import os
+import queue
 import struct
 import sys
+import threading
 import time
+from concurrent.futures import ThreadPoolExecutor
 from typing import List, Optional, SupportsInt
 import _compression  # noqa: I201  # Not third-party
 
 from . import igzip_lib, isal_zlib
 
-__all__ = ["IGzipFile", "open", "compress", "decompress", "BadGzipFile",
-           "READ_BUFFER_SIZE"]
+__all__ = ["IGzipFile", "ParallelIGzipFile", "open", "compress",
+           "decompress", "BadGzipFile", "READ_BUFFER_SIZE",
+           "PARALLEL_BLOCK_SIZE", "GzipIndex", "build_index", "INDEX_SPACING"]
 
 _COMPRESS_LEVEL_FAST = isal_zlib.ISAL_BEST_SPEED
 _COMPRESS_LEVEL_TRADEOFF = isal_zlib.ISAL_DEFAULT_COMPRESSION
@@ -44,6 +51,28 @@ _COMPRESS_LEVEL_BEST = isal_zlib.ISAL_BEST_COMPRESSION
 #: Increasing this value may increase performance.
 READ_BUFFER_SIZE = io.DEFAULT_BUFFER_SIZE
 
+#: The amount of uncompressed data that is compressed as a single unit when
+#: compressing on multiple threads.
+PARALLEL_BLOCK_SIZE = 1024 * 1024
+
+#: The default amount of uncompressed data between the checkpoints of a
+#: GzipIndex.
+INDEX_SPACING = 1024 * 1024
+
+# The amount of decompressed data that a read-ahead thread passes to the
+# reading thread at once.
+_READAHEAD_CHUNK_SIZE = 128 * 1024
+
+# The amount of uncompressed data that a writer collects before passing it to
+# its background compression thread, and the number of such chunks that can
+# be waiting for the thread.
+_BACKGROUND_CHUNK_SIZE = 128 * 1024
+_BACKGROUND_CHUNKS = 2
+
+# Size of the deflate window. Parallel compressed blocks use this amount of
+# the preceding data as a dictionary.
+_WINDOW_SIZE = 32 * 1024
+
 FTEXT, FHCRC, FEXTRA, FNAME, FCOMMENT = 1, 2, 4, 8, 16
 
 try:
@@ -54,7 +83,8 @@ except AttributeError:  # Versions lower than 3.8 do not have BadGzipFile
 
 # The open method was copied from the CPython source with minor adjustments.
 def open(filename, mode="rb", compresslevel=_COMPRESS_LEVEL_TRADEOFF,
-         encoding=None, errors=None, newline=None):
+         encoding=None, errors=None, newline=None, threads=1, index=None,
+         readahead=0, background=False):
     """Open a gzip-compressed file in binary or text mode. This uses the isa-l
     library for optimized speed.
 
@@ -73,6 +103,14 @@ def open(filename, mode="rb", compresslevel=_COMPRESS_LEVEL_TRADEOFF,
     io.TextIOWrapper instance with the specified encoding, error handling
     behavior, and line ending(s).
 
+    A threads value larger than 1 returns a ParallelIGzipFile that uses that
+    many threads. When writing, blocks are compressed in parallel. When
+    reading, the members of multi-member files are decompressed in parallel.
+
+    An index created by build_index can be given to speed up seeking when
+    reading. With readahead larger than 0, decompression runs ahead of the
+    caller on a background thread. With background set to True, writing
+    compresses the data on a background thread. See IGzipFile.
     """
     if "t" in mode:
         if "b" in mode:
@@ -87,11 +125,20 @@ def open(filename, mode="rb", compresslevel=_COMPRESS_LEVEL_TRADEOFF,
             raise ValueError("Argument 'newline' not supported in binary mode")
 
     gz_mode = mode.replace("t", "")
+    if threads > 1:
+        if index is not None or readahead or background:
+            raise ValueError("index, readahead and background can not be "
+                             "used with multiple threads")
+        file_class = functools.partial(ParallelIGzipFile, threads=threads)
+    else:
+        file_class = functools.partial(IGzipFile, index=index,
+                                       readahead=readahead,
+                                       background=background)
     # __fspath__ method is os.PathLike
     if isinstance(filename, (str, bytes)) or hasattr(filename, "__fspath__"):
-        binary_file = IGzipFile(filename, gz_mode, compresslevel)
+        binary_file = file_class(filename, gz_mode, compresslevel)
     elif hasattr(filename, "read") or hasattr(filename, "write"):
-        binary_file = IGzipFile(None, gz_mode, compresslevel, filename)
+        binary_file = file_class(None, gz_mode, compresslevel, filename)
     else:
         raise TypeError("filename must be a str or bytes object, or a file")
 
@@ -110,7 +157,8 @@ class IGzipFile(gzip.GzipFile):
     """
     def __init__(self, filename=None, mode=None,
                  compresslevel=isal_zlib.ISAL_DEFAULT_COMPRESSION,
-                 fileobj=None, mtime=None):
+                 fileobj=None, mtime=None, hufftables=None, index=None,
+                 readahead=0, background=False):
         """Constructor for the IGzipFile class.
 
         At least one of fileobj and filename must be given a
@@ -141,7 +189,27 @@ class IGzipFile(gzip.GzipFile):
         The mtime argument is an optional numeric timestamp to be written
         to the last modification time field in the stream when compressing.
         If omitted or None, the current time is used.
+
+        The hufftables argument can be a HuffTables object created by
+        isal.igzip_lib.train_hufftables. These tables are used instead of the
+        default tables when compresslevel is 0.
+
+        The index argument can be a GzipIndex created by build_index, or the
+        name of a file it was saved to. When reading, seek() then starts
+        decompressing from the nearest checkpoint before the target instead
+        of from the start of the file.
+
+        The readahead argument enables a background thread when reading. It
+        reads and decompresses the file while the caller processes the data
+        that was already returned. Up to readahead chunks of 128K of
+        decompressed data are kept ready.
+
+        The background argument enables a background thread when writing.
+        Written data is collected in chunks of 128K that the thread compresses
+        and writes to the file while the caller continues. Errors of the
+        thread are raised by the next call to write, flush or close.
         """
+        self._background = None
         if not (isal_zlib.ISAL_BEST_SPEED <= compresslevel
                 <= isal_zlib.ISAL_BEST_COMPRESSION):
             raise ValueError(
@@ -150,14 +218,29 @@ class IGzipFile(gzip.GzipFile):
                 ))
         super().__init__(filename, mode, compresslevel, fileobj, mtime)
         if self.mode == gzip.WRITE:
-            self.compress = isal_zlib.compressobj(compresslevel,
-                                                  isal_zlib.DEFLATED,
-                                                  -isal_zlib.MAX_WBITS,
-                                                  isal_zlib.DEF_MEM_LEVEL,
-                                                  0)
+            self._init_writer(compresslevel, hufftables, background)
         if self.mode == gzip.READ:
-            raw = _IGzipReader(self.fileobj)
-            self._buffer = io.BufferedReader(raw)
+            self._init_reader(index, readahead)
+
+    def _init_writer(self, compresslevel, hufftables, background):
+        # ISA-L keeps track of the CRC and the size of the data and writes
+        # the trailer, so write needs no separate pass over the data.
+        self.compress = igzip_lib.IgzipCompressor(
+            compresslevel, igzip_lib.COMP_GZIP_NO_HDR, hufftables=hufftables)
+        if background:
+            self._background = _BackgroundCompressor(self.compress,
+                                                     self.fileobj)
+
+    def _init_reader(self, index, readahead):
+        if isinstance(index, (str, bytes)) or hasattr(index, "__fspath__"):
+            index = GzipIndex.load(index)
+        if index is not None:
+            raw = _IGzipReader(self.fileobj, index)
+        else:
+            raw = _NativeGzipReader(self.fileobj)
+        if readahead > 0:
+            raw = _ReadaheadReader(raw, readahead)
+        self._buffer = io.BufferedReader(raw)
 
     def __repr__(self):
         s = repr(self.fileobj)
@@ -203,12 +286,271 @@ class IGzipFile(gzip.GzipFile):
             length = data.nbytes
 
         if length > 0:
-            self.fileobj.write(self.compress.compress(data))
+            if self._background is not None:
+                self._background.write(data)
+            else:
+                self.fileobj.write(self.compress.compress(data))
             self.size += length
-            self.crc = isal_zlib.crc32(data, self.crc)
             self.offset += length
         return length
 
+    def flush(self, zlib_mode=isal_zlib.Z_SYNC_FLUSH):
+        self._check_not_closed()
+        if self.mode != gzip.WRITE:
+            return
+        if self._background is not None:
+            # The compressor can only be flushed once the thread is idle.
+            self._background.flush()
+        if zlib_mode == isal_zlib.Z_SYNC_FLUSH:
+            self.fileobj.write(self.compress.flush(igzip_lib.ISAL_SYNC_FLUSH))
+        elif zlib_mode == isal_zlib.Z_FULL_FLUSH:
+            self.fileobj.write(self.compress.flush(igzip_lib.ISAL_FULL_FLUSH))
+        elif zlib_mode != isal_zlib.Z_NO_FLUSH:
+            raise ValueError("Unsupported flush mode")
+        self.fileobj.flush()
+
+    def close(self):
+        if self.mode != gzip.WRITE or self.fileobj is None:
+            return super().close()
+        fileobj = self.fileobj
+        background = self._background
+        self._background = None
+        try:
+            # When the background thread failed, the compressed stream is
+            # incomplete and the file is closed without finishing it.
+            if background is not None:
+                background.close()
+            # This includes the gzip trailer.
+            fileobj.write(self.compress.finish())
+        finally:
+            self.fileobj = None
+            myfileobj = self.myfileobj
+            if myfileobj:
+                self.myfileobj = None
+                myfileobj.close()
+
+
+class _BackgroundCompressor:
+    """Compress data and write it to a file object on a background thread.
+    Written data is collected in a chunk, and at most _BACKGROUND_CHUNKS full
+    chunks wait for the thread. The caller thus fills the next chunk while the
+    thread compresses the previous one with the GIL released. Errors are
+    raised in the calling thread."""
+    def __init__(self, compress, fileobj):
+        self._compress = compress
+        self._fileobj = fileobj
+        self._pending = bytearray()
+        self._chunks = queue.Queue(_BACKGROUND_CHUNKS)
+        self._error = None
+        # A daemon thread does not prevent exiting when a file is not closed.
+        self._thread = threading.Thread(target=self._compress_chunks,
+                                        daemon=True)
+        self._thread.start()
+
+    def _compress_chunks(self):
+        while True:
+            chunk = self._chunks.get()
+            try:
+                if chunk is None:
+                    return
+                # After an error, chunks are still taken from the queue so
+                # the calling thread never blocks on a full queue.
+                if self._error is None:
+                    self._fileobj.write(self._compress.compress(chunk))
+            except BaseException as error:
+                self._error = error
+            finally:
+                self._chunks.task_done()
+
+    def _check_error(self):
+        if self._error is not None:
+            raise self._error
+
+    def _submit_pending(self):
+        if self._pending:
+            # The bytearray is handed off as a whole rather than copied.
+            self._chunks.put(self._pending)
+            self._pending = bytearray()
+
+    def write(self, data):
+        self._check_error()
+        # The data is always copied, as the caller may change its buffer after
+        # write returns.
+        self._pending += data
+        if len(self._pending) >= _BACKGROUND_CHUNK_SIZE:
+            self._submit_pending()
+
+    def flush(self):
+        self._check_error()
+        self._submit_pending()
+        self._chunks.join()
+        self._check_error()
+
+    def close(self):
+        """Wait for all data to be written and stop the thread."""
+        try:
+            if self._error is None:
+                self._submit_pending()
+        finally:
+            self._chunks.put(None)
+            self._thread.join()
+        self._check_error()
+
+
+def _compress_block(data, compresslevel, zdict, last, hufftables=None):
+    """
+    Compress a block that is part of a larger deflate stream.
+
+    :param data: The block of data to compress.
+    :param compresslevel: The compression level.
+    :param zdict: The data preceding this block. Used to prime the window.
+    :param last: Whether this is the final block of the deflate stream. Other
+                 blocks are ended with a sync flush so they end on a byte
+                 boundary and can be concatenated.
+    :param hufftables: Custom Huffman tables or None for the default tables.
+    :return: A tuple of the compressed data, the CRC32 of the data and the
+             length of the data.
+    """
+    compressor = isal_zlib.compressobj(compresslevel, isal_zlib.DEFLATED,
+                                       -isal_zlib.MAX_WBITS,
+                                       isal_zlib.DEF_MEM_LEVEL,
+                                       0, zdict, hufftables)
+    compressed = compressor.compress(data)
+    flushed = compressor.flush(isal_zlib.Z_FINISH if last
+                               else isal_zlib.Z_SYNC_FLUSH)
+    return compressed + flushed, isal_zlib.crc32(data), len(data)
+
+
+class ParallelIGzipFile(IGzipFile):
+    """An IGzipFile that compresses or decompresses on multiple threads.
+
+    When writing, the data is cut into blocks of block_size bytes that are
+    compressed independently, with the last 32K of the preceding block as
+    dictionary. Since the dictionary primes the compression window, the
+    compression ratio is very close to that of single threaded compression.
+    The blocks are joined into a single gzip member that can be read by any
+    gzip reader.
+
+    When reading, the file is split at the starts of gzip members, which are
+    decompressed on multiple threads. This speeds up files that consist of
+    many members, such as files written by bgzip. Files with a single member
+    are decompressed on one thread.
+    """
+    def __init__(self, filename=None, mode=None,
+                 compresslevel=isal_zlib.ISAL_DEFAULT_COMPRESSION,
+                 fileobj=None, mtime=None, threads=None,
+                 block_size=PARALLEL_BLOCK_SIZE, hufftables=None):
+        """Constructor for the ParallelIGzipFile class.
+
+        The arguments are the same as for IGzipFile.
+
+        The threads argument is the number of threads used for compression or
+        decompression. It defaults to the number of available CPUs.
+
+        The block_size argument is the amount of uncompressed data that is
+        compressed by a thread in one go.
+        """
+        if block_size < 1:
+            raise ValueError("block_size must be at least 1")
+        if threads is None:
+            threads = os.cpu_count() or 1
+        self._threads = threads
+        self._block_size = block_size
+        super().__init__(filename, mode, compresslevel, fileobj, mtime,
+                         hufftables)
+
+    def _init_writer(self, compresslevel, hufftables, background):
+        self._executor = ThreadPoolExecutor(self._threads)
+        self._compresslevel = compresslevel
+        self._hufftables = hufftables
+        self._pending = bytearray()
+        self._zdict = b""
+        self._results = collections.deque()
+
+    def _init_reader(self, index, readahead):
+        raw = _ParallelIGzipReader(self.fileobj, self._threads)
+        self._buffer = io.BufferedReader(raw)
+
+    def _submit_block(self, block, last=False):
+        self._results.append(self._executor.submit(
+            _compress_block, block, self._compresslevel, self._zdict, last,
+            self._hufftables))
+        if len(block) >= _WINDOW_SIZE:
+            self._zdict = block[-_WINDOW_SIZE:]
+        else:
+            self._zdict = (self._zdict + block)[-_WINDOW_SIZE:]
+        # Limit the amount of data that is in flight. Finished blocks are
+        # written immediately, in order.
+        while len(self._results) > 2 * self._threads:
+            self._write_result()
+        while self._results and self._results[0].done():
+            self._write_result()
+
+    def _write_result(self):
+        compressed, crc, length = self._results.popleft().result()
+        self.fileobj.write(compressed)
+        self.crc = isal_zlib.crc32_combine(self.crc, crc, length)
+
+    def write(self, data):
+        if self.mode != gzip.WRITE:
+            return super().write(data)
+        self._check_not_closed()
+        if self.fileobj is None:
+            raise ValueError("write() on closed ParallelIGzipFile object")
+
+        # accept any data that supports the buffer protocol
+        data = memoryview(data).cast("B")
+        length = data.nbytes
+        if length == 0:
+            return 0
+        block_size = self._block_size
+        if self._pending:
+            needed = block_size - len(self._pending)
+            self._pending += data[:needed]
+            data = data[needed:]
+            if len(self._pending) == block_size:
+                self._submit_block(bytes(self._pending))
+                self._pending = bytearray()
+        while len(data) >= block_size:
+            self._submit_block(bytes(data[:block_size]))
+            data = data[block_size:]
+        self._pending += data
+        self.size += length
+        self.offset += length
+        return length
+
+    def flush(self, zlib_mode=isal_zlib.Z_SYNC_FLUSH):
+        if self.mode != gzip.WRITE:
+            return super().flush(zlib_mode)
+        self._check_not_closed()
+        if self._pending:
+            self._submit_block(bytes(self._pending))
+            self._pending = bytearray()
+        while self._results:
+            self._write_result()
+        self.fileobj.flush()
+
+    def close(self):
+        if self.mode != gzip.WRITE:
+            return super().close()
+        fileobj = self.fileobj
+        if fileobj is None:
+            return
+        try:
+            self._submit_block(bytes(self._pending), last=True)
+            self._pending = bytearray()
+            while self._results:
+                self._write_result()
+            fileobj.write(struct.pack("<II", self.crc,
+                                      self.size & 0xFFFFFFFF))
+        finally:
+            self.fileobj = None
+            self._executor.shutdown()
+            myfileobj = self.myfileobj
+            if myfileobj:
+                self.myfileobj = None
+                myfileobj.close()
+
 
 class _PaddedFile(gzip._PaddedFile):
     # Overwrite _PaddedFile from gzip as its prepend method assumes that
@@ -228,22 +570,438 @@ class _PaddedFile(gzip._PaddedFile):
         self._length = len(self._buffer)
         self._read = 0
 
+    def unread(self):
+        # Return the buffered data that was not read yet. The data after it
+        # is read from the file.
+        if self._read is None:
+            return b""
+        data = self._buffer[self._read:self._length]
+        self._read = None
+        self._buffer = None
+        return data
 
-class _IGzipReader(gzip._GzipReader):
+    def tell(self):
+        # Position in the file of the next byte that read() will return.
+        position = self.file.tell()
+        if self._read is not None:
+            position -= self._length - self._read
+        return position
+
+
+def _find_member_start(data, start):
+    """Return the position of the first possible gzip member header in data
+    at or after start, or -1 if there is none."""
+    while True:
+        pos = data.find(b"\x1f\x8b\x08", start)
+        if pos == -1:
+            return -1
+        # The reserved flag bits must be zero.
+        if pos + 3 < len(data) and not data[pos + 3] & 0xE0:
+            return pos
+        start = pos + 1
+
+
+class _ParallelIGzipReader(io.RawIOBase):
+    """Decompress gzip members on multiple threads.
+
+    The compressed data is read in batches. Each batch is split at possible
+    member starts, found by their magic bytes, and the pieces are decompressed
+    in parallel. A piece that does not decompress into whole members, with a
+    correct CRC and length, means that a split point was not a real member
+    start. The member at the start of that piece is then decompressed
+    sequentially with an _IGzipReader, which also reports any real errors in
+    the data. Batches are split again from the member after it. Since a
+    deflate stream can only be decoded from its start, a file with a single
+    member is always decompressed sequentially.
+
+    The pieces are decompressed as a whole, so the mtime reported for the
+    data of a piece is that of the first member in it.
+    """
+    def __init__(self, fp, threads):
+        self._fp = fp
+        self._threads = threads
+        self._executor = ThreadPoolExecutor(threads)
+        self._carry = b""
+        # Pairs of decompressed data and the mtime of their member.
+        self._blocks = collections.deque()
+        self._sequential = None
+        self._eof = False
+        self._pos = 0
+        self._last_mtime = None
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return self._fp.seekable()
+
+    def tell(self):
+        return self._pos
+
+    def close(self):
+        self._executor.shutdown()
+        self._blocks.clear()
+        self._close_sequential()
+        return super().close()
+
+    def _close_sequential(self):
+        if self._sequential is not None:
+            self._sequential.close()
+            self._sequential = None
+
+    def readinto(self, b):
+        with memoryview(b) as view, view.cast("B") as byte_view:
+            while not self._blocks:
+                if self._sequential is not None:
+                    written = self._sequential.readinto(byte_view)
+                    if self._sequential._last_mtime is not None:
+                        self._last_mtime = self._sequential._last_mtime
+                    if self._sequential._decompressor.eof:
+                        self._resume_parallel()
+                    elif not written:
+                        self._close_sequential()
+                        self._eof = True
+                    self._pos += written
+                    if written:
+                        return written
+                    continue
+                if self._eof:
+                    return 0
+                self._read_batch()
+            block, self._last_mtime = self._blocks[0]
+            written = min(len(byte_view), len(block))
+            byte_view[:written] = block[:written]
+            if written == len(block):
+                self._blocks.popleft()
+            else:
+                self._blocks[0] = (block[written:], self._last_mtime)
+            self._pos += written
+            return written
+
+    def _split_points(self, data, at_end):
+        # Split into one piece per thread. When more data follows, an extra
+        # piece is held back, as it may continue beyond this batch.
+        parts = self._threads if at_end else self._threads + 1
+        points = [0]
+        for i in range(1, parts):
+            start = max(len(data) * i // parts, points[-1] + 1)
+            pos = _find_member_start(data, start)
+            if pos == -1:
+                break
+            points.append(pos)
+        if at_end:
+            points.append(len(data))
+        return points
+
+    def _read_batch(self):
+        batch_size = self._threads * PARALLEL_BLOCK_SIZE
+        new_data = self._fp.read(batch_size)
+        data = self._carry + new_data
+        if not data:
+            self._eof = True
+            return
+        # A short read usually means the end of the file. If it is not, the
+        # last piece fails to decompress and is handled sequentially.
+        points = self._split_points(data, len(new_data) < batch_size)
+        if len(points) < 2:
+            # No member starts were found. This is probably a single member
+            # file.
+            self._start_sequential(data)
+            return
+        futures = [self._executor.submit(decompress, data[start:end])
+                   for start, end in zip(points, points[1:])]
+        self._carry = data[points[-1]:]
+        for start, future in zip(points, futures):
+            try:
+                block = future.result()
+            # BadGzipFile and IsalError are both OSErrors.
+            except (EOFError, OSError):
+                for other in futures:
+                    other.cancel()
+                self._start_sequential(data[start:])
+                return
+            if block:
+                mtime, = struct.unpack_from("<I", data, start + 4)
+                self._blocks.append((memoryview(block), mtime))
+
+    def _start_sequential(self, data):
+        # data is followed by the rest of self._fp.
+        self._carry = b""
+        self._close_sequential()
+        self._sequential = _IGzipReader(self._fp, prepend=data)
+
+    def _resume_parallel(self):
+        # The sequential reader has decompressed its member. Check the
+        # trailer and continue with batches from the next member on.
+        self._sequential._read_eof()
+        self._carry = self._sequential._fp.unread()
+        self._close_sequential()
+
+    def seek(self, offset, whence=io.SEEK_SET):
+        # Same approach as _compression.DecompressReader.seek
+        if whence == io.SEEK_SET:
+            pass
+        elif whence == io.SEEK_CUR:
+            offset = self._pos + offset
+        elif whence == io.SEEK_END:
+            # Seeking relative to EOF - we need to know the file's size.
+            while self.read(io.DEFAULT_BUFFER_SIZE):
+                pass
+            offset = self._pos + offset
+        else:
+            raise ValueError("Invalid value for whence: {}".format(whence))
+
+        if offset < self._pos:
+            self._fp.seek(0)
+            self._carry = b""
+            self._blocks.clear()
+            self._close_sequential()
+            self._eof = False
+            self._pos = 0
+        while offset > self._pos:
+            if not self.read(min(io.DEFAULT_BUFFER_SIZE, offset - self._pos)):
+                break
+        return self._pos
+
+
+class _ReadaheadReader(io.RawIOBase):
+    """Run a reader on a background thread that puts the decompressed data in
+    a queue of at most readahead chunks. File reading and decompression then
+    overlap with the work of the thread that consumes the data. Errors are
+    raised in the consuming thread.
+
+    The reader runs ahead, so its mtime can belong to a later member. Each
+    chunk is queued with the mtime of its member, which becomes _last_mtime
+    when the chunk is handed out."""
+    def __init__(self, reader, readahead):
+        self._reader = reader
+        self._readahead = readahead
+        self._chunks = None
+        self._stop = None
+        self._thread = None
+        self._chunk = memoryview(b"")
+        self._eof = False
+        self._error = None
+        self._pos = 0
+        self._last_mtime = None
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return self._reader.seekable()
+
+    def tell(self):
+        return self._pos
+
+    def _start_thread(self):
+        # The thread is started on the first read, so nothing is read when
+        # the file is only opened.
+        self._chunks = queue.Queue(self._readahead)
+        self._stop = threading.Event()
+        # A daemon thread does not prevent exiting when a file is not closed.
+        self._thread = threading.Thread(
+            target=self._read_ahead, args=(self._chunks, self._stop),
+            daemon=True)
+        self._thread.start()
+
+    def _read_ahead(self, chunks, stop):
+        try:
+            while not stop.is_set():
+                # A single read does not go past the end of a member.
+                chunk = self._reader.read(_READAHEAD_CHUNK_SIZE)
+                chunks.put((chunk, self._reader._last_mtime))
+                if not chunk:
+                    return
+        except BaseException as error:
+            chunks.put(error)
+
+    def _stop_thread(self):
+        if self._thread is None:
+            return
+        self._stop.set()
+        # Make room for a put that may be waiting. The thread checks the stop
+        # flag after each put.
+        try:
+            while True:
+                self._chunks.get_nowait()
+        except queue.Empty:
+            pass
+        self._thread.join()
+        self._thread = None
+
+    def readinto(self, b):
+        with memoryview(b) as view, view.cast("B") as byte_view:
+            if not self._chunk:
+                if self._error is not None:
+                    raise self._error
+                if self._eof:
+                    return 0
+                if self._thread is None:
+                    self._start_thread()
+                item = self._chunks.get()
+                if isinstance(item, BaseException):
+                    self._error = item
+                    self._thread.join()
+                    self._thread = None
+                    raise item
+                chunk, self._last_mtime = item
+                if not chunk:
+                    self._eof = True
+                    self._thread.join()
+                    self._thread = None
+                    return 0
+                self._chunk = memoryview(chunk)
+            written = min(len(byte_view), len(self._chunk))
+            byte_view[:written] = self._chunk[:written]
+            self._chunk = self._chunk[written:]
+            self._pos += written
+            return written
+
+    def seek(self, offset, whence=io.SEEK_SET):
+        if whence == io.SEEK_CUR:
+            offset = self._pos + offset
+            whence = io.SEEK_SET
+        # Seeking within the current chunk does not disturb the thread.
+        if (whence == io.SEEK_SET and
+                self._pos <= offset <= self._pos + len(self._chunk)):
+            self._chunk = self._chunk[offset - self._pos:]
+            self._pos = offset
+            return self._pos
+        self._stop_thread()
+        # The reader is ahead of this object. Seeking it to the absolute
+        # offset discards whatever it had read ahead.
+        self._pos = self._reader.seek(offset, whence)
+        self._last_mtime = self._reader._last_mtime
+        self._chunk = memoryview(b"")
+        self._eof = False
+        self._error = None
+        return self._pos
+
+    def close(self):
+        self._stop_thread()
+        self._chunk = memoryview(b"")
+        self._reader.close()
+        return super().close()
+
+
+class _NativeGzipReader(io.RawIOBase):
+    """Raw reader for IGzipFile. The loop over the members of the file, the
+    parsing of headers and trailers and the reading of the compressed data all
+    happen in igzip_lib.GzipReader. _IGzipReader is used instead where its
+    Python-level state is needed, such as for the checkpoints of an index."""
     def __init__(self, fp):
+        self._fp = fp
+        self._reader = igzip_lib.GzipReader(fp, READ_BUFFER_SIZE)
+        self._size = -1
+
+    @property
+    def _last_mtime(self):
+        return self._reader.mtime
+
+    def readable(self):
+        return True
+
+    def seekable(self):
+        return self._fp.seekable()
+
+    def tell(self):
+        return self._reader.tell()
+
+    def readinto(self, b):
+        written = self._reader.readinto(b)
+        if not written:
+            self._size = self._reader.tell()
+        return written
+
+    # Same as _compression.DecompressReader.seek, but discarding the data
+    # with readinto.
+    def seek(self, offset, whence=io.SEEK_SET):
+        if whence == io.SEEK_SET:
+            pass
+        elif whence == io.SEEK_CUR:
+            offset = self.tell() + offset
+        elif whence == io.SEEK_END:
+            # Seeking relative to EOF - we need to know the file's size.
+            if self._size < 0:
+                while self.read(io.DEFAULT_BUFFER_SIZE):
+                    pass
+            offset = self._size + offset
+        else:
+            raise ValueError("Invalid value for whence: {}".format(whence))
+
+        # Make it so that offset is the number of bytes to skip forward.
+        if offset < self.tell():
+            self._reader.rewind()
+        else:
+            offset -= self.tell()
+
+        # Read and discard data until we reach the desired position.
+        buffer = bytearray(min(io.DEFAULT_BUFFER_SIZE, max(offset, 0)))
+        with memoryview(buffer) as view:
+            while offset > 0:
+                written = self.readinto(view[:min(len(view), offset)])
+                if not written:
+                    break
+                offset -= written
+        return self.tell()
+
+
+class _IGzipReader(gzip._GzipReader):
+    def __init__(self, fp, index=None, prepend=b""):
         # Call the init method of gzip._GzipReader's parent here.
         # It is not very invasive and allows us to override _PaddedFile
         _compression.DecompressReader.__init__(
-            self, _PaddedFile(fp), igzip_lib.IgzipDecompressor,
-            hist_bits=igzip_lib.MAX_HIST_BITS, flag=igzip_lib.DECOMP_DEFLATE)
+            self, _PaddedFile(fp, prepend), igzip_lib.IgzipDecompressor,
+            hist_bits=igzip_lib.MAX_HIST_BITS,
+            flag=igzip_lib.DECOMP_GZIP_NO_HDR)
         # Set flag indicating start of a new member
         self._new_member = True
         self._last_mtime = None
+        self._index = index
+        self._read_size = READ_BUFFER_SIZE
+
+    def seek(self, offset, whence=io.SEEK_SET):
+        if self._index is not None and whence != io.SEEK_END:
+            if whence == io.SEEK_CUR:
+                offset = self._pos + offset
+                whence = io.SEEK_SET
+            checkpoint = self._index._find(offset)
+            # Only restore when it saves decompressing data.
+            if checkpoint is not None and (
+                    offset < self._pos or
+                    checkpoint.uncompressed_offset > self._pos):
+                self._restore(checkpoint)
+        return super().seek(offset, whence)
+
+    def _checkpoint(self, window):
+        # Return a checkpoint at the current position, or None when the
+        # decompressor is not waiting at a deflate block boundary. window
+        # must hold the last 32K of output. The bytes held back for the next
+        # block header are read again after a restore.
+        state = self._decompressor._get_state()
+        if state is None:
+            return None
+        bits, bit_count, held_back = state
+        return _Checkpoint(self._pos, self._fp.tell() - held_back, bits,
+                           bit_count, self._crc, self._stream_size,
+                           bytes(window))
+
+    def _restore(self, checkpoint):
+        self._fp.seek(checkpoint.compressed_offset)
+        self._decompressor = self._decomp_factory(**self._decomp_args)
+        self._decompressor._set_state(checkpoint.bits, checkpoint.bit_count,
+                                      checkpoint.window, checkpoint.crc)
+        self._new_member = False
+        self._eof = False
+        self._crc = checkpoint.crc
+        self._stream_size = checkpoint.stream_size
+        self._pos = checkpoint.uncompressed_offset
 
     def _add_read_data(self, data):
-        # Use faster isal crc32 calculation and update the stream size in place
-        # compared to CPython gzip
-        self._crc = isal_zlib.crc32(data, self._crc)
+        # The decompressor computes the CRC during decompression. The trailer
+        # is still read by _read_eof.
+        self._crc = self._decompressor.crc
         self._stream_size += len(data)
 
     def read(self, size=-1):
@@ -257,28 +1015,12 @@ class _IGzipReader(gzip._GzipReader):
         # call to decompress() may not return
         # any data. In this case, retry until we get some data or reach EOF.
         while True:
-            if self._decompressor.eof:
-                # Ending case: we've come to the end of a member in the file,
-                # so finish up this member, and read a new gzip header.
-                # Check the CRC and file size, and set the flag so we read
-                # a new member
-                self._read_eof()
-                self._new_member = True
-                self._decompressor = self._decomp_factory(
-                    **self._decomp_args)
-
-            if self._new_member:
-                # If the _new_member flag is set, we have to
-                # jump to the next member, if there is one.
-                self._init_read()
-                if not self._read_gzip_header():
-                    self._size = self._pos
-                    return b""
-                self._new_member = False
+            if not self._prepare_member():
+                return b""
 
             # Read a chunk of data from the file
             if self._decompressor.needs_input:
-                buf = self._fp.read(READ_BUFFER_SIZE)
+                buf = self._fp.read(self._read_size)
                 uncompress = self._decompressor.decompress(buf, size)
             else:
                 uncompress = self._decompressor.decompress(b"", size)
@@ -297,6 +1039,189 @@ class _IGzipReader(gzip._GzipReader):
         self._pos += len(uncompress)
         return uncompress
 
+    def readinto(self, b):
+        # Decompress straight into the caller's buffer instead of creating an
+        # intermediate bytes object like DecompressReader.readinto does.
+        with memoryview(b) as view, view.cast("B") as byte_view:
+            size = len(byte_view)
+            if not size:
+                return 0
+            while True:
+                if not self._prepare_member():
+                    return 0
+                if self._decompressor.needs_input:
+                    buf = self._fp.read(self._read_size)
+                    written = self._decompressor.decompress_into(
+                        buf, byte_view)
+                else:
+                    buf = None
+                    written = self._decompressor.decompress_into(
+                        b"", byte_view)
+                if self._decompressor.unused_data != b"":
+                    self._fp.prepend(self._decompressor.unused_data)
+                if written:
+                    break
+                if buf == b"":
+                    raise EOFError("Compressed file ended before the "
+                                   "end-of-stream marker was reached")
+            self._add_read_data(byte_view[:written])
+            self._pos += written
+            return written
+
+    def _prepare_member(self):
+        """Finish the current member if it has ended and read the header of
+        the next one when needed. Return False at the end of the file."""
+        if self._decompressor.eof:
+            # Ending case: we've come to the end of a member in the file,
+            # so finish up this member, and read a new gzip header.
+            # Check the CRC and file size, and set the flag so we read
+            # a new member
+            self._read_eof()
+            self._new_member = True
+            self._decompressor = self._decomp_factory(
+                **self._decomp_args)
+
+        if self._new_member:
+            # If the _new_member flag is set, we have to
+            # jump to the next member, if there is one.
+            self._init_read()
+            if not self._read_gzip_header():
+                self._size = self._pos
+                return False
+            self._new_member = False
+        return True
+
+
+_Checkpoint = collections.namedtuple(
+    "_Checkpoint", ["uncompressed_offset", "compressed_offset", "bits",
+                    "bit_count", "crc", "stream_size", "window"])
+
+_INDEX_MAGIC = b"ISALIDX2"
+_INDEX_HEADER = struct.Struct("<QQ")
+_INDEX_CHECKPOINT = struct.Struct("<QQQBIQI")
+_INDEX_WINDOW_SIZE = 32 * 1024
+# Input is fed in pieces of this size while build_index looks for a block
+# boundary. Most block headers are longer, so they are split between two
+# pieces and the decompressor stops in front of them.
+_INDEX_READ_SIZE = 64
+
+
+class GzipIndex:
+    """Checkpoints into a gzip file that allow IGzipFile to seek without
+    decompressing everything before the target position.
+
+    Create an index with build_index. It can be saved to a sidecar file with
+    save and loaded again with GzipIndex.load. A checkpoint is placed at a
+    deflate block boundary and contains the bit offset of the block and the
+    32K of data before it, so the index does not depend on the ISA-L
+    version.
+    """
+    def __init__(self, spacing=INDEX_SPACING):
+        self.spacing = spacing
+        self._checkpoints = []
+        self._offsets = []
+
+    def __len__(self):
+        return len(self._checkpoints)
+
+    def _add(self, checkpoint):
+        self._checkpoints.append(checkpoint)
+        self._offsets.append(checkpoint.uncompressed_offset)
+
+    def _find(self, offset):
+        # Return the last checkpoint at or before offset.
+        i = bisect.bisect_right(self._offsets, offset)
+        if i == 0:
+            return None
+        return self._checkpoints[i - 1]
+
+    def save(self, filename):
+        """Save the index to filename."""
+        with io.open(filename, "wb") as index_file:
+            index_file.write(_INDEX_MAGIC)
+            index_file.write(_INDEX_HEADER.pack(self.spacing,
+                                                len(self._checkpoints)))
+            for checkpoint in self._checkpoints:
+                window = isal_zlib.compress(checkpoint.window, 1)
+                index_file.write(_INDEX_CHECKPOINT.pack(
+                    checkpoint.uncompressed_offset,
+                    checkpoint.compressed_offset, checkpoint.bits,
+                    checkpoint.bit_count, checkpoint.crc,
+                    checkpoint.stream_size, len(window)))
+                index_file.write(window)
+
+    @classmethod
+    def load(cls, filename):
+        """Load an index that was saved with save."""
+        with io.open(filename, "rb") as index_file:
+            data = index_file.read()
+        if not data.startswith(_INDEX_MAGIC):
+            raise ValueError("Not a gzip index file")
+        pos = len(_INDEX_MAGIC)
+        try:
+            spacing, number = _INDEX_HEADER.unpack_from(data, pos)
+            pos += _INDEX_HEADER.size
+            index = cls(spacing)
+            for _ in range(number):
+                (uncompressed_offset, compressed_offset, bits, bit_count, crc,
+                 stream_size, window_length) = \
+                    _INDEX_CHECKPOINT.unpack_from(data, pos)
+                pos += _INDEX_CHECKPOINT.size
+                if pos + window_length > len(data):
+                    raise ValueError("Truncated gzip index")
+                window = isal_zlib.decompress(data[pos:pos + window_length])
+                pos += window_length
+                if bit_count > 64 or len(window) > _INDEX_WINDOW_SIZE:
+                    raise ValueError("Invalid checkpoint in gzip index")
+                index._add(_Checkpoint(uncompressed_offset, compressed_offset,
+                                       bits, bit_count, crc, stream_size,
+                                       window))
+        except struct.error:
+            raise ValueError("Truncated gzip index")
+        return index
+
+
+def build_index(filename, spacing=INDEX_SPACING):
+    """Decompress a gzip file and return a GzipIndex with a checkpoint about
+    every spacing bytes of uncompressed data.
+
+    The filename argument can be a file name or a seekable binary file
+    object.
+    """
+    if spacing < 1:
+        raise ValueError("spacing must be at least 1")
+    if hasattr(filename, "read"):
+        fileobj = filename
+    else:
+        fileobj = io.open(filename, "rb")
+    try:
+        reader = _IGzipReader(fileobj)
+        index = GzipIndex(spacing)
+        buffer = bytearray(128 * 1024)
+        window = bytearray()
+        next_checkpoint = spacing
+        while True:
+            written = reader.readinto(buffer)
+            if not written:
+                break
+            window += buffer[max(written - _INDEX_WINDOW_SIZE, 0):written]
+            del window[:-_INDEX_WINDOW_SIZE]
+            if reader._pos < next_checkpoint:
+                continue
+            # Read small pieces until the decompressor stops at a deflate
+            # block boundary, where it can be resumed without its internal
+            # state.
+            reader._read_size = _INDEX_READ_SIZE
+            checkpoint = reader._checkpoint(window)
+            if checkpoint is not None:
+                index._add(checkpoint)
+                next_checkpoint = reader._pos + spacing
+                reader._read_size = READ_BUFFER_SIZE
+        return index
+    finally:
+        if fileobj is not filename:
+            fileobj.close()
+
 
 # Aliases for improved compatibility with CPython gzip module.
 GzipFile = IGzipFile
@@ -321,16 +1246,51 @@ def _create_simple_gzip_header(compresslevel,
     return struct.pack("<BBBBLBB", 0x1f, 0x8b, 8, 0, int(mtime), xfl, 255)
 
 
-def compress(data, compresslevel=_COMPRESS_LEVEL_BEST, mtime=None):
+def _compress_parallel(data, compresslevel, threads, hufftables=None,
+                       header=b""):
+    """Compress data on multiple threads into a single raw deflate stream and
+    return it with the given header and a gzip trailer."""
+    view = memoryview(data).cast("B")
+    starts = range(0, len(view), PARALLEL_BLOCK_SIZE)
+    last_start = starts[-1]
+    with ThreadPoolExecutor(threads) as executor:
+        futures = [
+            executor.submit(_compress_block,
+                            view[start:start + PARALLEL_BLOCK_SIZE],
+                            compresslevel,
+                            bytes(view[max(0, start - _WINDOW_SIZE):start]),
+                            start == last_start,
+                            hufftables)
+            for start in starts]
+        results = [future.result() for future in futures]
+    crc = 0
+    for _, block_crc, length in results:
+        crc = isal_zlib.crc32_combine(crc, block_crc, length)
+    trailer = struct.pack("<II", crc, len(view) & 0xFFFFFFFF)
+    return b"".join([header] + [compressed for compressed, _, _ in results] +
+                    [trailer])
+
+
+def compress(data, compresslevel=_COMPRESS_LEVEL_BEST, mtime=None, threads=1,
+             hufftables=None):
     """Compress data in one shot and return the compressed string.
     Optional argument is the compression level, in range of 0-3.
+
+    When threads is larger than 1, data larger than PARALLEL_BLOCK_SIZE is
+    compressed in blocks on multiple threads. The result is still a single
+    gzip member.
+
+    Custom Huffman tables from isal.igzip_lib.train_hufftables can be passed
+    with hufftables. They are only used at compression level 0.
     """
-    header = _create_simple_gzip_header(compresslevel, mtime)
-    # use igzip_lib to compress the data without a gzip header but with a
-    # gzip trailer.
-    compressed = igzip_lib.compress(data, compresslevel,
-                                    flag=igzip_lib.COMP_GZIP_NO_HDR)
-    return header + compressed
+    if threads > 1 and memoryview(data).nbytes > PARALLEL_BLOCK_SIZE:
+        header = _create_simple_gzip_header(compresslevel, mtime)
+        return _compress_parallel(data, compresslevel, threads, hufftables,
+                                  header)
+    # ISA-L writes the header, the compressed data and the trailer into a
+    # single output buffer.
+    return igzip_lib.compress_gzip(data, compresslevel, mtime,
+                                   hufftables=hufftables)
 
 
 def _gzip_header_end(data):
@@ -381,26 +1341,9 @@ def decompress(data):
     """Decompress a gzip compressed string in one shot.
     Return the decompressed string.
     """
-    all_blocks = []
-    while True:
-        if data == b"":
-            break
-        header_end = _gzip_header_end(data)
-        do = isal_zlib.decompressobj(-15)
-        block = do.decompress(data[header_end:]) + do.flush()
-        if not do.eof or len(do.unused_data) < 8:
-            raise EOFError("Compressed file ended before the end-of-stream "
-                           "marker was reached")
-        checksum, length = struct.unpack("<II", do.unused_data[:8])
-        crc = isal_zlib.crc32(block)
-        if crc != checksum:
-            raise BadGzipFile("CRC check failed")
-        if length != len(block):
-            raise BadGzipFile("Incorrect length of data produced")
-        all_blocks.append(block)
-        # Remove all padding null bytes and start next block.
-        data = do.unused_data[8:].lstrip(b"\x00")
-    return b"".join(all_blocks)
+    # All members are decompressed natively from the same buffer into a
+    # single output buffer.
+    return igzip_lib.decompress_gzip(data)
 
 
 def _argument_parser():
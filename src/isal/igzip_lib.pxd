@@ -21,7 +21,14 @@
 # cython: language_level=3
 # cython: binding=True
 
-cdef extern from "<isa-l/igzip_lib.h>":
+from cpython.pythread cimport (
+    PyThread_type_lock, PyThread_acquire_lock, WAIT_LOCK, NOWAIT_LOCK)
+from cpython.ref cimport PyObject
+
+# All ISA-L functions are reentrant and do not touch Python objects, so they
+# are declared nogil. This allows the GIL to be released around the actual
+# compression and decompression work.
+cdef extern from "<isa-l/igzip_lib.h>" nogil:
     # Deflate compression standard defines
     int ISAL_DEF_MAX_HDR_SIZE
     int ISAL_DEF_MAX_CODE_LEN
@@ -31,10 +38,12 @@ cdef extern from "<isa-l/igzip_lib.h>":
     int ISAL_DEF_MAX_MATCH
     int ISAL_DEF_MIN_MATCH
 
-    int ISAL_DEF_LIT_SYMBOLS
-    int ISAL_DEF_LEN_SYMBOLS
-    int ISAL_DEF_DIST_SYMBOLS
-    int ISAL_DEF_LIT_LEN_SYMBOLS
+    # Declared as enum so they can be used as array sizes.
+    enum:
+        ISAL_DEF_LIT_SYMBOLS
+        ISAL_DEF_LEN_SYMBOLS
+        ISAL_DEF_DIST_SYMBOLS
+        ISAL_DEF_LIT_LEN_SYMBOLS
 
     # Deflate Implementation Specific Define
     int IGZIP_HIST_SIZE
@@ -192,6 +201,12 @@ cdef extern from "<isa-l/igzip_lib.h>":
     cdef struct isal_hufftables:
         pass
 
+    cdef struct isal_huff_histogram:
+        unsigned long long lit_len_histogram[ISAL_DEF_LIT_LEN_SYMBOLS]  #!< Histogram of Literal/Len symbols seen
+        unsigned long long dist_histogram[ISAL_DEF_DIST_SYMBOLS]  #!< Histogram of Distance Symbols seen
+        # hash_table is omitted. It is only used internally by
+        # isal_update_histogram.
+
     cdef struct isal_zstream:
         unsigned char *next_in  #!< Next input byte
         unsigned int avail_in  #!< number of bytes available at next_in
@@ -209,6 +224,14 @@ cdef extern from "<isa-l/igzip_lib.h>":
         unsigned short hist_bits  #!< Log base 2 of maximum lookback distance, 0 is use default
         isal_zstate internal_state  #!< Internal state for this stream
 
+    # Only the fields that are used are declared. The history and hash table
+    # arrays follow them.
+    cdef struct isal_dict:
+        unsigned int params
+        unsigned int level
+        unsigned int hist_size
+        unsigned int hash_size
+
     # Inflate structures
     cdef struct inflate_huff_code_large:
         pass
@@ -231,6 +254,9 @@ cdef extern from "<isa-l/igzip_lib.h>":
         unsigned int crc_flag  #!< Flag identifying whether to track of crc
         unsigned int crc  #!< Contains crc or adler32 of output if crc_flag is set
         unsigned int hist_bits  #!< Log base 2 of maximum lookback distance
+        int tmp_in_size  #!< Number of bytes in tmp_in_buffer
+        int tmp_out_valid  #!< Number of bytes in tmp_out_buffer
+        int tmp_out_processed  #!< Number of bytes processed in tmp_out_buffer
         # Other members are omitted because they are not in use yet.
 
     # Compression functions
@@ -241,6 +267,18 @@ cdef extern from "<isa-l/igzip_lib.h>":
     #  * @returns none
     #  */
     cdef void isal_deflate_init(isal_zstream *stream)
+
+    #/**
+    #  * @brief Reinitialize compression stream data structure. Performs the same
+    #  * action as isal_deflate_init, but does not change user supplied input such as
+    #  * the level, flush type, compression wrapper (like gzip), hist_bits, name, and
+    #  * other similar variables.
+    #  *
+    #  * @param stream Structure holding state information on the compression streams.
+    #  * @returns none
+    #  */
+    cdef void isal_deflate_reset(isal_zstream *stream)
+
     #/**
     #  * @brief Initialize compression stream data structure
     #  *
@@ -267,6 +305,45 @@ cdef extern from "<isa-l/igzip_lib.h>":
                                    unsigned char *dict,
                                    unsigned int dict_len )
 
+    #  /**
+    #  * @brief Process dictionary to reuse later
+    #  *
+    #  * Processes a dictionary so that the generated output can be reused to
+    #  * reset a new deflate stream more quickly than isal_deflate_set_dict()
+    #  * alone. This function is paired with isal_deflate_reset_dict(), when
+    #  * using the same dictionary on multiple deflate objects. The stream.level
+    #  * must be set prior to calling this function to process the dictionary
+    #  * correctly. If the dictionary is longer than IGZIP_HIST_SIZE, only the
+    #  * last IGZIP_HIST_SIZE bytes will be used.
+    #  *
+    #  * @param stream Structure holding state information on the compression
+    #  * streams.
+    #  * @param dict_str: Structure to hold the processed dictionary.
+    #  * @param dict: Array containing dictionary to use.
+    #  * @param dict_len: Length of dict.
+    #  * @returns COMP_OK,
+    #  *          ISAL_INVALID_STATE (dictionary could not be processed)
+    #  */
+    int isal_deflate_process_dict(isal_zstream *stream, isal_dict *dict_str,
+                                  unsigned char *dict, unsigned int dict_len)
+
+    #  /**
+    #  * @brief Reset compression dictionary to use
+    #  *
+    #  * This function is intended to be called after isal_deflate_init() or
+    #  * isal_deflate_reset() when the same dictionary is used on multiple
+    #  * deflate objects. The dictionary must have been processed with
+    #  * isal_deflate_process_dict() at the same compression level as the
+    #  * stream.
+    #  *
+    #  * @param stream Structure holding state information on the compression
+    #  * streams.
+    #  * @param dict_str: Structure holding the processed dictionary.
+    #  * @returns COMP_OK,
+    #  *          ISAL_INVALID_STATE or other (dictionary could not be reset)
+    #  */
+    int isal_deflate_reset_dict(isal_zstream *stream, isal_dict *dict_str)
+
 
     #/**
     #  * @brief Fast data (deflate) compression for storage applications.
@@ -435,6 +512,124 @@ cdef extern from "<isa-l/igzip_lib.h>":
     #  */
     int isal_inflate(inflate_state *state)
 
+    # /**
+    #  * @brief Fast data (deflate) stateless decompression for storage applications.
+    #  *
+    #  * Stateless (one shot) decompression routine with a similar interface to
+    #  * isal_inflate() but operates on entire input buffer at one time. Parameter
+    #  * avail_out must be large enough to fit the entire decompressed
+    #  * output. Dictionaries are not supported.
+    #  *
+    #  * @param  state Structure holding state information on the compression streams.
+    #  * @return ISAL_DECOMP_OK (if everything is ok),
+    #  *         ISAL_END_INPUT (if all input was decompressed),
+    #  *         ISAL_NEED_DICT,
+    #  *         ISAL_OUT_OVERFLOW (if output buffer ran out of space),
+    #  *         ISAL_INVALID_BLOCK,
+    #  *         ISAL_INVALID_SYMBOL,
+    #  *         ISAL_INVALID_LOOKBACK,
+    #  *         ISAL_INVALID_WRAPPER,
+    #  *         ISAL_UNSUPPORTED_METHOD,
+    #  *         ISAL_INCORRECT_CHECKSUM.
+    #  */
+    int isal_inflate_stateless(inflate_state *state)
+
+    ###########################
+    # Gzip header functions
+    ###########################
+    cdef struct isal_gzip_header:
+        unsigned int text  #!< Optional Text hint
+        unsigned int time  #!< Unix modification time in gzip header
+        unsigned int xflags  #!< xflags in gzip header
+        unsigned int os  #!< OS in gzip header
+        unsigned char *extra  #!< Extra field in gzip header
+        unsigned int extra_buf_len  #!< Length of extra buffer
+        unsigned int extra_len  #!< Actual length of gzip header extra field
+        char *name  #!< Name in gzip header
+        unsigned int name_buf_len  #!< Length of name buffer
+        char *comment  #!< Comments in gzip header
+        unsigned int comment_buf_len  #!< Length of comment buffer
+        unsigned int hcrc  #!< Header crc or header crc flag
+        unsigned int flags  #!< Internal data
+
+    # /**
+    #  * @brief Initialize gzip header structure to default values.
+    #  *
+    #  * @param gz_hdr: Gzip header to initialize.
+    #  */
+    void isal_gzip_header_init(isal_gzip_header *gz_hdr)
+
+    # /**
+    #  * @brief Read and return gzip header information
+    #  *
+    #  * On entering this function, it is assumed that the stream structure has
+    #  * been initialized, and that state->next_in is at the start of the gzip
+    #  * header. The function can be called again with more input when
+    #  * ISAL_END_INPUT or an overflow of one of the buffers in gz_hdr is
+    #  * returned.
+    #  *
+    #  * @param state: inflate_state structure
+    #  * @param gz_hdr: isal_gzip_header structure to be filled in
+    #  * @returns ISAL_DECOMP_OK (header was successfully parsed)
+    #  *          ISAL_END_INPUT (all input was parsed),
+    #  *          ISAL_NAME_OVERFLOW (gz_hdr->name overflowed while parsing),
+    #  *          ISAL_COMMENT_OVERFLOW (gz_hdr->comment overflowed while parsing),
+    #  *          ISAL_EXTRA_OVERFLOW (gz_hdr->extra overflowed while parsing),
+    #  *          ISAL_INVALID_WRAPPER (invalid gzip header found),
+    #  *          ISAL_UNSUPPORTED_METHOD (deflate is not the compression method),
+    #  *          ISAL_INCORRECT_CHECKSUM (gzip header checksum was incorrect)
+    #  */
+    int isal_read_gzip_header(inflate_state *state, isal_gzip_header *gz_hdr)
+
+    # /**
+    #  * @brief Write gzip header to output stream
+    #  *
+    #  * Writes the gzip header to the output stream. On entry this function
+    #  * assumes that the output buffer has been initialized, so stream->next_out,
+    #  * stream->avail_out and stream->total_out have been set. If the output
+    #  * buffer contains insufficient space, stream is not modified.
+    #  *
+    #  * @param stream: Structure holding state information on the compression
+    #  * stream.
+    #  * @param gz_hdr: Structure holding the gzip header information to encode.
+    #  *
+    #  * @returns Returns 0 if the header is successfully written, otherwise
+    #  * returns the minimum size required to successfully write the gzip header
+    #  * to the output buffer.
+    #  */
+    unsigned int isal_write_gzip_header(isal_zstream *stream,
+                                        isal_gzip_header *gz_hdr)
+
+    ##########################
+    # Huffman table functions
+    ##########################
+    # /**
+    #  * @brief Updates histograms to include the symbols found in the input
+    #  * stream. Since this function only updates the histograms, it can be called on
+    #  * multiple streams to get a histogram better representing the desired data
+    #  * set. When first using histogram it must be initialized by zeroing the
+    #  * structure.
+    #  *
+    #  * @param in_stream: Input stream of data.
+    #  * @param length: The length of start_stream.
+    #  * @param histogram: The returned histogram of lit/len/dist symbols.
+    #  */
+    void isal_update_histogram(unsigned char * in_stream, int length,
+                               isal_huff_histogram * histogram)
+
+    # /**
+    #  * @brief Creates a custom huffman code for the given histograms in which
+    #  *  every literal and repeat length is assigned a code and all possible lookback
+    #  *  distances are assigned a code.
+    #  *
+    #  * @param hufftables: the output structure containing the huffman code
+    #  * @param histogram: histogram containing frequency of literal symbols,
+    #  *        repeat lengths and lookback distances
+    #  * @returns Returns a non zero value if an invalid huffman code was created.
+    #  */
+    int isal_create_hufftables(isal_hufftables * hufftables,
+                               isal_huff_histogram * histogram)
+
     ##########################
     # Other functions
     ##########################
@@ -470,18 +665,30 @@ cdef inline Py_ssize_t py_ssize_t_min(Py_ssize_t a, Py_ssize_t b):
     else:
         return b
 
+cdef inline void acquire_lock(PyThread_type_lock lock):
+    # Same as ENTER_ZLIB in zlibmodule.c. The GIL is only released when the
+    # lock is contended so the common uncontended case stays cheap.
+    if not PyThread_acquire_lock(lock, NOWAIT_LOCK):
+        with nogil:
+            PyThread_acquire_lock(lock, WAIT_LOCK)
+
 cdef Py_ssize_t arrange_output_buffer_with_maximum(stream_or_state *stream,
-                                                   unsigned char **buffer,
+                                                   PyObject **buffer,
                                                    Py_ssize_t length,
                                                    Py_ssize_t max_length)
 
 
 cdef Py_ssize_t arrange_output_buffer(stream_or_state *stream,
-                                      unsigned char **buffer,
+                                      PyObject **buffer,
                                       Py_ssize_t length)
 
+cdef bytes output_buffer_to_bytes(stream_or_state *stream, PyObject **buffer)
+
 cdef void arrange_input_buffer(stream_or_state *stream, Py_ssize_t *remains)
 
+cdef void arrange_fixed_output_buffer(stream_or_state *stream,
+                                      unsigned char *buffer_end)
+
 cdef:
     int MEM_LEVEL_DEFAULT_I
     int MEM_LEVEL_MIN_I
@@ -489,20 +696,52 @@ cdef:
     int MEM_LEVEL_MEDIUM_I
     int MEM_LEVEL_LARGE_I
     int MEM_LEVEL_EXTRA_LARGE_I
+    int MEM_LEVEL_AUTO_I
     int ISAL_DEFAULT_COMPRESSION_I
 
 cdef int mem_level_to_bufsize(int compression_level, int mem_level, unsigned int *bufsize)
 
+cdef class HuffTables:
+    cdef isal_hufftables *tables
+    cdef isal_huff_histogram histogram
+
+cdef int set_hufftables(isal_zstream *stream, object hufftables) except -1
+
 cdef _compress(data,
              int level,
              int flag,
              int mem_level,
              int hist_bits,
+             object hufftables=*,
             )
 
+cdef _compress_iov(fragments,
+                   int level,
+                   int flag,
+                   int mem_level,
+                   int hist_bits,
+                   object hufftables=*,
+                   bint chunks=*)
+
+cdef deflate_fragments(isal_zstream *stream, fragments, bint finish,
+                       list chunks=*)
+
 cdef _decompress(data,
                  int flag,
                  int hist_bits,
                  Py_ssize_t bufsize)
 
+cdef Py_ssize_t _compress_into(data,
+                               out,
+                               int level,
+                               int flag,
+                               int mem_level,
+                               int hist_bits,
+                               ) except -1
+
+cdef Py_ssize_t _decompress_into(data,
+                                 out,
+                                 int flag,
+                                 int hist_bits) except -1
+
 cdef bytes view_bitbuffer(inflate_state * stream)
\ No newline at end of file
@@ -18,6 +18,8 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+from typing import List, Optional, Union
+
 ISAL_BEST_SPEED: int
 ISAL_BEST_COMPRESSION: int
 ISAL_DEFAULT_COMPRESSION: int
@@ -44,19 +46,94 @@ MEM_LEVEL_SMALL: int
 MEM_LEVEL_MEDIUM: int
 MEM_LEVEL_LARGE: int
 MEM_LEVEL_EXTRA_LARGE: int
+MEM_LEVEL_AUTO: int
 IsalError: OSError
+BadGzipFile: OSError
+
+class HuffTables:
+    def to_bytes(self) -> bytes: ...
+    @classmethod
+    def from_bytes(cls, data) -> "HuffTables": ...
+
+def train_hufftables(samples) -> HuffTables: ...
 
 def compress(data, level: int = ISAL_DEFAULT_COMPRESSION,
              flag: int = COMP_DEFLATE,
              mem_level: int = MEM_LEVEL_DEFAULT,
-             hist_bits: int = MAX_HIST_BITS) -> bytes: ...
+             hist_bits: int = MAX_HIST_BITS,
+             hufftables: Optional[HuffTables] = None) -> bytes: ...
+def compress_gzip(data, level: int = ISAL_DEFAULT_COMPRESSION,
+                  mtime: Optional[float] = None,
+                  name: Optional[bytes] = None,
+                  extra: Optional[bytes] = None,
+                  mem_level: int = MEM_LEVEL_DEFAULT,
+                  hist_bits: int = MAX_HIST_BITS,
+                  hufftables: Optional[HuffTables] = None) -> bytes: ...
 def decompress(data, flag: int = DECOMP_DEFLATE,
                hist_bits: int = MAX_HIST_BITS,
                bufsize: int = DEF_BUF_SIZE) -> bytes: ...
+def decompress_gzip(data) -> bytes: ...
+def compress_iov(fragments, level: int = ISAL_DEFAULT_COMPRESSION,
+                 flag: int = COMP_DEFLATE,
+                 mem_level: int = MEM_LEVEL_DEFAULT,
+                 hist_bits: int = MAX_HIST_BITS,
+                 hufftables: Optional[HuffTables] = None,
+                 chunks: bool = False) -> Union[bytes, List[bytes]]: ...
+def compress_into(data, out, level: int = ISAL_DEFAULT_COMPRESSION,
+                  flag: int = COMP_DEFLATE,
+                  mem_level: int = MEM_LEVEL_DEFAULT,
+                  hist_bits: int = MAX_HIST_BITS) -> int: ...
+def decompress_into(data, out, flag: int = DECOMP_DEFLATE,
+                    hist_bits: int = MAX_HIST_BITS) -> int: ...
+def compress_many(buffers, level: int = ISAL_DEFAULT_COMPRESSION,
+                  flag: int = COMP_DEFLATE,
+                  mem_level: int = MEM_LEVEL_DEFAULT,
+                  hist_bits: int = MAX_HIST_BITS,
+                  hufftables: Optional[HuffTables] = None,
+                  threads: int = 1) -> List[bytes]: ...
+def decompress_many(buffers, flag: int = DECOMP_DEFLATE,
+                    hist_bits: int = MAX_HIST_BITS,
+                    bufsize: int = DEF_BUF_SIZE,
+                    threads: int = 1) -> List[bytes]: ...
+
+class Compressor:
+    def __init__(self, level: int = ISAL_DEFAULT_COMPRESSION,
+                 flag: int = COMP_DEFLATE,
+                 mem_level: int = MEM_LEVEL_DEFAULT,
+                 hist_bits: int = MAX_HIST_BITS,
+                 hufftables: Optional[HuffTables] = None): ...
+    def compress(self, data) -> bytes: ...
+    def reset(self) -> None: ...
+
+class Decompressor:
+    def __init__(self, flag: int = DECOMP_DEFLATE,
+                 hist_bits: int = MAX_HIST_BITS): ...
+    def decompress(self, data, bufsize: int = DEF_BUF_SIZE) -> bytes: ...
+    def reset(self) -> None: ...
+
+class IgzipCompressor:
+    def __init__(self, level: int = ISAL_DEFAULT_COMPRESSION,
+                 flag: int = COMP_DEFLATE,
+                 mem_level: int = MEM_LEVEL_DEFAULT,
+                 hist_bits: int = MAX_HIST_BITS,
+                 hufftables: Optional[HuffTables] = None): ...
+    def compress(self, data) -> bytes: ...
+    def flush(self, mode: int = ISAL_SYNC_FLUSH) -> bytes: ...
+    def finish(self) -> bytes: ...
 
 class IgzipDecompressor:
     unused_data: bytes
     needs_input: bool
     eof: bool
+    crc: int
 
     def decompress(self, data, max_length = -1) -> bytes: ...
+    def decompress_into(self, data, out) -> int: ...
+
+class GzipReader:
+    mtime: Optional[int]
+
+    def __init__(self, fp, buffersize: int = ...): ...
+    def readinto(self, b) -> int: ...
+    def tell(self) -> int: ...
+    def rewind(self) -> None: ...
@@ -64,17 +64,40 @@ This module comes with the following constants:
 ``MEM_LEVEL_MEDIUM``
 ``MEM_LEVEL_LARGE``
 ``MEM_LEVEL_EXTRA_LARGE``      The largest memory level.
+``MEM_LEVEL_AUTO``             Choose the memory level from the input size.
+                               Only one-shot functions know the input size,
+                               compressor objects use MEM_LEVEL_DEFAULT.
 ============================== ================================================
 """
 
+from libc.limits cimport INT_MAX
 from libc.stdint cimport UINT64_MAX, UINT32_MAX
-from libc.string cimport memmove, memcpy
+from libc.string cimport memmove, memcpy, memset
 from cpython.mem cimport PyMem_Malloc, PyMem_Realloc, PyMem_Free
-from cpython.buffer cimport PyBUF_C_CONTIGUOUS, PyObject_GetBuffer, PyBuffer_Release
+from cpython.buffer cimport (
+    PyBUF_C_CONTIGUOUS, PyBUF_WRITABLE, PyObject_GetBuffer, PyBuffer_Release)
 from cpython.bytes cimport PyBytes_FromStringAndSize
+from cpython.bytearray cimport PyByteArray_AS_STRING
+from cpython.pythread cimport (
+    PyThread_type_lock, PyThread_allocate_lock, PyThread_free_lock,
+    PyThread_release_lock)
+from cpython.ref cimport PyObject, Py_INCREF, Py_XDECREF
+
+from .crc cimport crc32_gzip_refl
+
+import struct
+import threading
+import time
 
 cdef extern from "<Python.h>":
     const Py_ssize_t PY_SSIZE_T_MAX
+    # Raw versions of the bytes API. The output buffers are bytes objects that
+    # are resized in place, which requires working with PyObject pointers.
+    PyObject *new_bytes_buffer "PyBytes_FromStringAndSize" (const char *v,
+                                                            Py_ssize_t length)
+    char *PyBytes_AS_STRING(PyObject *string)
+    Py_ssize_t PyBytes_GET_SIZE(PyObject *string)
+    int _PyBytes_Resize(PyObject **string, Py_ssize_t newsize)
 
 ISAL_BEST_SPEED = ISAL_DEF_MIN_LEVEL
 ISAL_BEST_COMPRESSION = ISAL_DEF_MAX_LEVEL
@@ -82,6 +105,12 @@ cdef int ISAL_DEFAULT_COMPRESSION_I = 2
 ISAL_DEFAULT_COMPRESSION = ISAL_DEFAULT_COMPRESSION_I
 
 DEF DEF_BUF_SIZE_I = 16 * 1024
+# Inputs up to this size are handled by the stateless (one shot) ISA-L
+# functions first. These skip the streaming state machine which dominates the
+# cost for small inputs.
+DEF STATELESS_MAX_SIZE_I = 64 * 1024
+# Output chunks start at DEF_BUF_SIZE and double up to this size.
+DEF OUTPUT_CHUNK_MAX_I = 256 * 1024
 DEF_BUF_SIZE = DEF_BUF_SIZE_I
 MAX_HIST_BITS = ISAL_DEF_MAX_HIST_BITS
 
@@ -109,36 +138,63 @@ cdef int MEM_LEVEL_SMALL_I = 2
 cdef int MEM_LEVEL_MEDIUM_I = 3
 cdef int MEM_LEVEL_LARGE_I = 4
 cdef int MEM_LEVEL_EXTRA_LARGE_I = 5
+cdef int MEM_LEVEL_AUTO_I = 6
 MEM_LEVEL_DEFAULT = MEM_LEVEL_DEFAULT_I
 MEM_LEVEL_MIN = MEM_LEVEL_MIN_I
 MEM_LEVEL_SMALL = MEM_LEVEL_SMALL_I
 MEM_LEVEL_MEDIUM = MEM_LEVEL_MEDIUM_I
 MEM_LEVEL_LARGE = MEM_LEVEL_LARGE_I
 MEM_LEVEL_EXTRA_LARGE = MEM_LEVEL_EXTRA_LARGE_I
+MEM_LEVEL_AUTO = MEM_LEVEL_AUTO_I
 
 class IsalError(OSError):
     """Exception raised on compression and decompression errors."""
     pass
 
+try:
+    from gzip import BadGzipFile
+except ImportError:  # Python < 3.8
+    BadGzipFile = OSError
+
+
+# One-shot compression needs a level buffer of up to several hundred KB.
+# Rather than allocating one for every call, one buffer is cached per thread.
+# It is taken out of the cache while it is in use, so it is never shared. A
+# buffer that is larger than needed can be used, as the stream is given the
+# size it needs. Only the largest buffer is kept, so each thread holds at most
+# one buffer of the largest size it used. It is freed when the thread ends.
+_level_buf_cache = threading.local()
+
+cdef bytearray take_level_buf(unsigned int size):
+    level_buf = getattr(_level_buf_cache, "buffer", None)
+    if level_buf is None or len(level_buf) < size:
+        return bytearray(size)
+    _level_buf_cache.buffer = None
+    return level_buf
+
+cdef give_level_buf(bytearray level_buf):
+    cached = getattr(_level_buf_cache, "buffer", None)
+    if cached is None or len(cached) < len(level_buf):
+        _level_buf_cache.buffer = level_buf
 
 
 cdef Py_ssize_t arrange_output_buffer_with_maximum(stream_or_state *stream,
-                                                   unsigned char **buffer,
+                                                   PyObject **buffer,
                                                    Py_ssize_t length,
                                                    Py_ssize_t max_length):
-    # The zlibmodule.c function builds a PyBytes object. A unsigned char *
-    # is build here because building raw PyObject * stuff in cython is somewhat
-    # harder due to cython's interference. FIXME
+    # Same as the zlibmodule.c function. The output is written directly into
+    # a bytes object which is grown with _PyBytes_Resize. That way no copy is
+    # needed when the result is returned. The caller owns the reference in
+    # buffer and should release it with Py_XDECREF.
     cdef Py_ssize_t occupied
     cdef Py_ssize_t new_length
-    cdef unsigned char * new_buffer
     if buffer[0] == NULL:
-        buffer[0] = <unsigned char*>PyMem_Malloc(length * sizeof(char))
+        buffer[0] = new_bytes_buffer(NULL, length)
         if buffer[0] == NULL:
             return -1
         occupied = 0
     else:
-        occupied = stream.next_out - buffer[0]
+        occupied = stream.next_out - <unsigned char *>PyBytes_AS_STRING(buffer[0])
         if length == occupied:
             if length == max_length:
                 return -2
@@ -146,17 +202,15 @@ cdef Py_ssize_t arrange_output_buffer_with_maximum(stream_or_state *stream,
                 new_length = length << 1
             else:
                 new_length = max_length
-            new_buffer = <unsigned char *>PyMem_Realloc(buffer[0], new_length)
-            if new_buffer == NULL:
+            if _PyBytes_Resize(buffer, new_length) < 0:
                 return -1
-            buffer[0] = new_buffer
             length = new_length
-    stream.avail_out = <unsigned int>py_ssize_t_min(length - occupied, PY_SSIZE_T_MAX)
-    stream.next_out = buffer[0] + occupied
+    stream.avail_out = <unsigned int>py_ssize_t_min(length - occupied, UINT32_MAX)
+    stream.next_out = <unsigned char *>PyBytes_AS_STRING(buffer[0]) + occupied
     return length
 
 cdef Py_ssize_t arrange_output_buffer(stream_or_state *stream,
-                                      unsigned char **buffer,
+                                      PyObject **buffer,
                                       Py_ssize_t length):
     cdef Py_ssize_t ret
     ret = arrange_output_buffer_with_maximum(stream, buffer, length, PY_SSIZE_T_MAX)
@@ -164,15 +218,237 @@ cdef Py_ssize_t arrange_output_buffer(stream_or_state *stream,
         return -1
     return ret
 
+cdef bytes output_buffer_to_bytes(stream_or_state *stream, PyObject **buffer):
+    # Shrink the buffer to the written size and return it as a bytes object.
+    if buffer[0] == NULL:
+        return b""
+    cdef Py_ssize_t written = (
+        stream.next_out - <unsigned char *>PyBytes_AS_STRING(buffer[0]))
+    if written != PyBytes_GET_SIZE(buffer[0]):
+        if _PyBytes_Resize(buffer, written) < 0:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+    return <bytes>buffer[0]
+
+cdef Py_ssize_t arrange_output_chunk(isal_zstream *stream, PyObject **buffer,
+                                     list chunks,
+                                     Py_ssize_t length) except -1:
+    # Like arrange_output_buffer, but a full buffer is added to chunks and a
+    # new one of length bytes is started, so written output is never copied.
+    # Returns the length for the next buffer.
+    if buffer[0] != NULL:
+        if stream.avail_out != 0:
+            return length
+        chunks.append(<object>buffer[0])
+        Py_XDECREF(buffer[0])
+        buffer[0] = NULL
+    buffer[0] = new_bytes_buffer(NULL, length)
+    if buffer[0] == NULL:
+        raise MemoryError("Unsufficient memory for buffer allocation")
+    stream.next_out = <unsigned char *>PyBytes_AS_STRING(buffer[0])
+    stream.avail_out = <unsigned int>length
+    return py_ssize_t_min(length * 2, OUTPUT_CHUNK_MAX_I)
+
 cdef void arrange_input_buffer(stream_or_state *stream, Py_ssize_t *remains):
-    stream.avail_in = <unsigned int>py_ssize_t_min(remains[0], PY_SSIZE_T_MAX)
+    stream.avail_in = <unsigned int>py_ssize_t_min(remains[0], UINT32_MAX)
     remains[0] -= stream.avail_in
 
+cdef void arrange_fixed_output_buffer(stream_or_state *stream,
+                                      unsigned char *buffer_end):
+    # Used when writing into a caller supplied buffer that can not grow.
+    stream.avail_out = <unsigned int>py_ssize_t_min(
+        buffer_end - stream.next_out, UINT32_MAX)
+
+_HUFFTABLES_MAGIC = b"ISALHUF1"
+
+cdef class HuffTables:
+    """
+    Custom Huffman tables for compression. Create them from sample data with
+    :py:func:`train_hufftables`. HuffTables can be serialized with
+    :py:meth:`to_bytes` and restored with :py:meth:`from_bytes`. Pickling
+    is supported as well.
+
+    Custom Huffman tables are only used by compression level 0. The other
+    levels create optimal tables for each deflate block.
+    """
+    def __cinit__(self):
+        self.tables = <isal_hufftables *>PyMem_Malloc(sizeof(isal_hufftables))
+        if self.tables == NULL:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+        memset(&self.histogram, 0, sizeof(isal_huff_histogram))
+
+    def __init__(self):
+        # from_bytes and train_hufftables use __new__ and create the tables
+        # once their histogram is filled.
+        self.create()
+
+    def __dealloc__(self):
+        if self.tables != NULL:
+            PyMem_Free(self.tables)
+
+    cdef create(self):
+        if isal_create_hufftables(self.tables, &self.histogram) != 0:
+            raise IsalError("Invalid Huffman code created")
+
+    def to_bytes(self):
+        """
+        Serialize the Huffman tables. Returns a bytes object that can be
+        turned back into HuffTables with :py:meth:`from_bytes`.
+        """
+        cdef Py_ssize_t i
+        counts = [self.histogram.lit_len_histogram[i]
+                  for i in range(ISAL_DEF_LIT_LEN_SYMBOLS)]
+        counts.extend(self.histogram.dist_histogram[i]
+                      for i in range(ISAL_DEF_DIST_SYMBOLS))
+        return _HUFFTABLES_MAGIC + struct.pack(
+            "<%dQ" % len(counts), *counts)
+
+    @classmethod
+    def from_bytes(cls, data):
+        """
+        Restore Huffman tables serialized with :py:meth:`to_bytes`.
+        """
+        cdef Py_ssize_t number_of_counts = (ISAL_DEF_LIT_LEN_SYMBOLS +
+                                            ISAL_DEF_DIST_SYMBOLS)
+        data = bytes(data)
+        if (len(data) != len(_HUFFTABLES_MAGIC) + 8 * number_of_counts or
+                not data.startswith(_HUFFTABLES_MAGIC)):
+            raise ValueError("data does not contain serialized HuffTables")
+        counts = struct.unpack_from("<%dQ" % number_of_counts, data,
+                                    len(_HUFFTABLES_MAGIC))
+        cdef HuffTables hufftables = HuffTables.__new__(HuffTables)
+        cdef Py_ssize_t i
+        for i in range(ISAL_DEF_LIT_LEN_SYMBOLS):
+            hufftables.histogram.lit_len_histogram[i] = counts[i]
+        for i in range(ISAL_DEF_DIST_SYMBOLS):
+            hufftables.histogram.dist_histogram[i] = counts[
+                ISAL_DEF_LIT_LEN_SYMBOLS + i]
+        hufftables.create()
+        return hufftables
+
+    def __reduce__(self):
+        return _restore_hufftables, (self.to_bytes(),)
+
+
+def _restore_hufftables(data):
+    return HuffTables.from_bytes(data)
+
+
+def train_hufftables(samples):
+    """
+    Create Huffman tables that are optimised for data that looks like the
+    samples. Returns a HuffTables object that can be passed to the
+    compression functions.
+
+    :param samples: A bytes-like object or an iterable of bytes-like objects
+                    with representative data.
+    """
+    if isinstance(samples, (bytes, bytearray, memoryview)):
+        samples = [samples]
+    cdef HuffTables hufftables = HuffTables.__new__(HuffTables)
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    cdef unsigned char *data_ptr
+    cdef Py_ssize_t remaining
+    cdef int length
+    for sample in samples:
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(sample, buffer, PyBUF_C_CONTIGUOUS)
+        try:
+            data_ptr = <unsigned char *>buffer.buf
+            remaining = buffer.len
+            with nogil:
+                while remaining > 0:
+                    length = <int>py_ssize_t_min(remaining, INT_MAX)
+                    isal_update_histogram(data_ptr, length,
+                                          &hufftables.histogram)
+                    data_ptr += length
+                    remaining -= length
+        finally:
+            PyBuffer_Release(buffer)
+    hufftables.create()
+    return hufftables
+
+
+cdef int set_hufftables(isal_zstream *stream, object hufftables) except -1:
+    # Use custom Huffman tables for the stream. None keeps the default tables.
+    # The caller must keep a reference to the HuffTables object for as long
+    # as the stream is in use.
+    if hufftables is None:
+        return 0
+    if not isinstance(hufftables, HuffTables):
+        raise TypeError("hufftables must be a HuffTables object or None, "
+                        "not %s" % type(hufftables).__name__)
+    stream.hufftables = (<HuffTables>hufftables).tables
+    return 0
+
+
+cdef inline Py_ssize_t deflate_bound(Py_ssize_t length) nogil:
+    # Incompressible data is stored with a 5 byte header per 64K stored
+    # block. Also leave room for the deflate, gzip and zlib headers and
+    # trailers.
+    return length + (length >> 10) + ISAL_DEF_MAX_HDR_SIZE + 64
+
+
+cdef compress_stateless(isal_zstream *stream, unsigned char *data,
+                        Py_ssize_t length, isal_gzip_header *gz_hdr=NULL,
+                        Py_ssize_t gz_hdr_size=0):
+    # Compress data in one go into a bytes object that is large enough for
+    # incompressible data. Returns None when ISA-L reports an error, so the
+    # caller can fall back to streaming compression. A gzip header is written
+    # in front of the compressed data when gz_hdr is given.
+    cdef Py_ssize_t obuflen = deflate_bound(length) + gz_hdr_size
+    cdef PyObject *obuf = new_bytes_buffer(NULL, obuflen)
+    if obuf == NULL:
+        raise MemoryError("Unsufficient memory for buffer allocation")
+    cdef int err
+    try:
+        stream.next_in = data
+        stream.avail_in = <unsigned int>length
+        stream.next_out = <unsigned char *>PyBytes_AS_STRING(obuf)
+        stream.avail_out = <unsigned int>obuflen
+        if gz_hdr != NULL and isal_write_gzip_header(stream, gz_hdr) != 0:
+            return None
+        stream.flush = NO_FLUSH
+        stream.end_of_stream = 1
+        with nogil:
+            err = isal_deflate_stateless(stream)
+        if err != COMP_OK:
+            return None
+        return output_buffer_to_bytes(stream, &obuf)
+    finally:
+        Py_XDECREF(obuf)
+
+
+cdef decompress_stateless(inflate_state *stream, unsigned char *data,
+                          Py_ssize_t length, Py_ssize_t obuflen):
+    # Decompress data in one go into a bytes object of obuflen bytes.
+    # Returns None when the output does not fit or ISA-L reports an error, so
+    # the caller can fall back to streaming decompression. That also makes
+    # sure the errors are the same as for streaming decompression.
+    cdef PyObject *obuf = new_bytes_buffer(NULL, obuflen)
+    if obuf == NULL:
+        raise MemoryError("Unsufficient memory for buffer allocation")
+    cdef int err
+    try:
+        stream.next_in = data
+        stream.avail_in = <unsigned int>length
+        stream.next_out = <unsigned char *>PyBytes_AS_STRING(obuf)
+        stream.avail_out = <unsigned int>obuflen
+        with nogil:
+            err = isal_inflate_stateless(stream)
+        if err != ISAL_DECOMP_OK:
+            return None
+        return output_buffer_to_bytes(stream, &obuf)
+    finally:
+        Py_XDECREF(obuf)
+
+
 def compress(data,
              int level=ISAL_DEFAULT_COMPRESSION_I,
              int flag = IGZIP_DEFLATE,
              int mem_level = MEM_LEVEL_DEFAULT_I,
              int hist_bits = ISAL_DEF_MAX_HIST_BITS,
+             hufftables = None,
             ):
     """
     Compresses the bytes in *data*. Returns a bytes object with the
@@ -190,13 +466,16 @@ def compress(data,
                       MEM_LEVEL_DEFAULT (default, 
                       equivalent to MEM_LEVEL_LARGE), MEM_LEVEL_MIN, 
                       MEM_LEVEL_SMALL, MEM_LEVEL_MEDIUM, MEM_LEVEL_LARGE,
-                      MEM_LEVEL_EXTRA_LARGE.
+                      MEM_LEVEL_EXTRA_LARGE, MEM_LEVEL_AUTO. MEM_LEVEL_AUTO
+                      picks the smallest buffer that fits the input size.
     :param hist_bits: Sets the size of the view window. The size equals 
                       2^hist_bits. Similar to zlib wbits value, except that 
                       hist_bits is not used to set the compression flag.
                       This is best left at the default (15, maximum).
+    :param hufftables: Custom Huffman tables created by
+                       :py:func:`train_hufftables`. Only used at level 0.
     """
-    return _compress(data, level, flag, mem_level, hist_bits)
+    return _compress(data, level, flag, mem_level, hist_bits, hufftables)
 
 
 cdef _compress(data,
@@ -204,28 +483,47 @@ cdef _compress(data,
              int flag,
              int mem_level,
              int hist_bits,
+             object hufftables=None,
             ):
+    # initialise input
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+
     # Initialise stream
     cdef isal_zstream stream
     cdef unsigned int level_buf_size
-    mem_level_to_bufsize(level, MEM_LEVEL_DEFAULT_I, &level_buf_size)
-    cdef unsigned char* level_buf = <unsigned char*> PyMem_Malloc(level_buf_size * sizeof(char))
-    isal_deflate_init(&stream)
-    stream.level = level
-    stream.level_buf = level_buf
-    stream.level_buf_size = level_buf_size
-    stream.hist_bits = hist_bits
-    stream.gzip_flag = flag
+    cdef bytearray level_buf_obj = None
+    try:
+        mem_level = resolve_mem_level(mem_level, buffer.len)
+        mem_level_to_bufsize(level, mem_level, &level_buf_size)
+        level_buf_obj = take_level_buf(level_buf_size)
+        isal_deflate_init(&stream)
+        stream.level = level
+        stream.level_buf = <unsigned char*>PyByteArray_AS_STRING(level_buf_obj)
+        stream.level_buf_size = level_buf_size
+        stream.hist_bits = hist_bits
+        stream.gzip_flag = flag
+        set_hufftables(&stream, hufftables)
+        return deflate_all(&stream, buffer)
+    finally:
+        PyBuffer_Release(buffer)
+        if level_buf_obj is not None:
+            give_level_buf(level_buf_obj)
+
 
+cdef deflate_all(isal_zstream *stream, Py_buffer *buffer,
+                 isal_gzip_header *gz_hdr=NULL, Py_ssize_t gz_hdr_size=0):
+    # Compress the entire buffer into a complete stream and return it as a
+    # bytes object. The stream must be freshly initialised or reset. When
+    # gz_hdr is given, the gzip header of gz_hdr_size bytes is written to the
+    # start of the same output buffer.
     # Initialise output buffer
     cdef Py_ssize_t bufsize = DEF_BUF_SIZE_I
-    cdef unsigned char * obuf = NULL
-    
+    cdef PyObject * obuf = NULL
+
     # initialise input
-    cdef Py_buffer buffer_data
-    cdef Py_buffer* buffer = &buffer_data
-    # Cython makes sure error is handled when acquiring buffer fails.
-    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
     cdef Py_ssize_t ibuflen = buffer.len
     stream.next_in = <unsigned char*>buffer.buf
 
@@ -233,8 +531,24 @@ cdef _compress(data,
     cdef int err
 
     try:
+        if ibuflen <= STATELESS_MAX_SIZE_I:
+            result = compress_stateless(stream, <unsigned char*>buffer.buf,
+                                        ibuflen, gz_hdr, gz_hdr_size)
+            if result is not None:
+                return result
+            # Start over with streaming compression.
+            isal_deflate_reset(stream)
+            stream.next_in = <unsigned char*>buffer.buf
+        if gz_hdr != NULL:
+            if gz_hdr_size > bufsize:
+                bufsize = gz_hdr_size
+            bufsize = arrange_output_buffer(stream, &obuf, bufsize)
+            if bufsize == -1:
+                raise MemoryError("Unsufficient memory for buffer allocation")
+            if isal_write_gzip_header(stream, gz_hdr) != 0:
+                raise IsalError("Not enough room in output buffer")
         while True:
-            arrange_input_buffer(&stream, &ibuflen)
+            arrange_input_buffer(stream, &ibuflen)
             if ibuflen == 0:
                 stream.flush = FULL_FLUSH
                 stream.end_of_stream = 1
@@ -242,10 +556,11 @@ cdef _compress(data,
                 stream.flush = NO_FLUSH
 
             while True:
-                bufsize = arrange_output_buffer(&stream, &obuf, bufsize)
+                bufsize = arrange_output_buffer(stream, &obuf, bufsize)
                 if bufsize == -1:
                     raise MemoryError("Unsufficient memory for buffer allocation")
-                err = isal_deflate(&stream)
+                with nogil:
+                    err = isal_deflate(stream)
                 if err != COMP_OK:
                     check_isal_deflate_rc(err)
                 if stream.avail_out != 0:
@@ -254,11 +569,312 @@ cdef _compress(data,
                 raise AssertionError("Input stream should be empty")
             if stream.internal_state.state == ZSTATE_END:
                 break
-        return PyBytes_FromStringAndSize(<char*>obuf, stream.next_out - obuf)
+        return output_buffer_to_bytes(stream, &obuf)
+    finally:
+        Py_XDECREF(obuf)
+
+
+def compress_iov(fragments,
+                 int level=ISAL_DEFAULT_COMPRESSION_I,
+                 int flag=IGZIP_DEFLATE,
+                 int mem_level=MEM_LEVEL_DEFAULT_I,
+                 int hist_bits=ISAL_DEF_MAX_HIST_BITS,
+                 hufftables=None,
+                 bint chunks=False):
+    """
+    Compresses the concatenation of the buffers in the iterable *fragments*
+    and returns it as a bytes object. Each fragment is given to ISA-L in
+    turn, so the fragments do not have to be joined first.
+
+    :param chunks: Return a list of bytes objects instead, which can be
+                   passed to ``os.writev``. A full output buffer is added to
+                   the list and a new one is started, instead of growing a
+                   single buffer, which may copy the output written so far.
+
+    The other parameters are the same as for :py:func:`compress`.
+    """
+    return _compress_iov(fragments, level, flag, mem_level, hist_bits,
+                         hufftables, chunks)
+
+
+cdef _compress_iov(fragments,
+                   int level,
+                   int flag,
+                   int mem_level,
+                   int hist_bits,
+                   object hufftables=None,
+                   bint chunks=False):
+    cdef Py_buffer buffer_data
+    cdef Py_ssize_t total = 0
+    if mem_level == MEM_LEVEL_AUTO_I:
+        # The total size is needed up front.
+        fragments = list(fragments)
+        for fragment in fragments:
+            PyObject_GetBuffer(fragment, &buffer_data, PyBUF_C_CONTIGUOUS)
+            total += buffer_data.len
+            PyBuffer_Release(&buffer_data)
+    mem_level = resolve_mem_level(mem_level, total)
+    cdef isal_zstream stream
+    cdef unsigned int level_buf_size
+    mem_level_to_bufsize(level, mem_level, &level_buf_size)
+    cdef bytearray level_buf_obj = take_level_buf(level_buf_size)
+    try:
+        isal_deflate_init(&stream)
+        stream.level = level
+        stream.level_buf = <unsigned char*>PyByteArray_AS_STRING(level_buf_obj)
+        stream.level_buf_size = level_buf_size
+        stream.hist_bits = hist_bits
+        stream.gzip_flag = flag
+        set_hufftables(&stream, hufftables)
+        return deflate_fragments(&stream, fragments, True,
+                                 [] if chunks else None)
+    finally:
+        give_level_buf(level_buf_obj)
+
+
+cdef deflate_fragments(isal_zstream *stream, fragments, bint finish,
+                       list chunks=None):
+    # Give each buffer in fragments to the stream in turn and return the
+    # compressed output. The stream is ended after the last fragment when
+    # finish is true. When chunks is a list, the output buffers are added to
+    # it and it is returned instead of a single bytes object.
+    cdef PyObject *obuf = NULL
+    cdef Py_ssize_t bufsize = DEF_BUF_SIZE_I
+    cdef Py_buffer buffer_data
+    cdef Py_ssize_t ibuflen
+    cdef int err
+    try:
+        stream.flush = NO_FLUSH
+        for fragment in fragments:
+            # Cython makes sure error is handled when acquiring buffer fails.
+            PyObject_GetBuffer(fragment, &buffer_data, PyBUF_C_CONTIGUOUS)
+            try:
+                # With NO_FLUSH, ISA-L consumes all input and keeps what it
+                # still needs, so the buffer can be released afterwards.
+                stream.next_in = <unsigned char *>buffer_data.buf
+                ibuflen = buffer_data.len
+                while True:
+                    arrange_input_buffer(stream, &ibuflen)
+                    while True:
+                        if chunks is not None:
+                            bufsize = arrange_output_chunk(stream, &obuf,
+                                                           chunks, bufsize)
+                        else:
+                            bufsize = arrange_output_buffer(stream, &obuf,
+                                                            bufsize)
+                        if bufsize == -1:
+                            raise MemoryError(
+                                "Unsufficient memory for buffer allocation")
+                        with nogil:
+                            err = isal_deflate(stream)
+                        if err != COMP_OK:
+                            check_isal_deflate_rc(err)
+                        if stream.avail_out != 0:
+                            break
+                    if stream.avail_in != 0:
+                        raise AssertionError("Input stream should be empty")
+                    if ibuflen == 0:
+                        break
+            finally:
+                PyBuffer_Release(&buffer_data)
+        if finish:
+            stream.avail_in = 0
+            stream.flush = FULL_FLUSH
+            stream.end_of_stream = 1
+            while True:
+                if chunks is not None:
+                    bufsize = arrange_output_chunk(stream, &obuf, chunks,
+                                                   bufsize)
+                else:
+                    bufsize = arrange_output_buffer(stream, &obuf, bufsize)
+                if bufsize == -1:
+                    raise MemoryError(
+                        "Unsufficient memory for buffer allocation")
+                with nogil:
+                    err = isal_deflate(stream)
+                if err != COMP_OK:
+                    check_isal_deflate_rc(err)
+                if stream.internal_state.state == ZSTATE_END:
+                    break
+        if chunks is None:
+            return output_buffer_to_bytes(stream, &obuf)
+        if (obuf != NULL and
+                stream.next_out != <unsigned char *>PyBytes_AS_STRING(obuf)):
+            chunks.append(output_buffer_to_bytes(stream, &obuf))
+        return chunks
+    finally:
+        Py_XDECREF(obuf)
+
+
+def compress_gzip(data,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  mtime=None,
+                  name=None,
+                  extra=None,
+                  int mem_level=MEM_LEVEL_DEFAULT_I,
+                  int hist_bits=ISAL_DEF_MAX_HIST_BITS,
+                  hufftables=None):
+    """
+    Compresses the bytes in *data* into a complete gzip member. The header is
+    written by ISA-L into the same output buffer as the compressed data and
+    the trailer, so the result is not copied to add the header.
+
+    :param level: the compression level from 0 to 3.
+    :param mtime: The modification time stored in the header. Defaults to
+                  the current time.
+    :param name: Optional file name stored in the header (FNAME), as bytes
+                 without null bytes.
+    :param extra: Optional bytes for the extra field of the header (FEXTRA).
+    :param mem_level: Memory level used for the level buffer.
+    :param hist_bits: Sets the size of the view window.
+    :param hufftables: Custom Huffman tables created by
+                       :py:func:`train_hufftables`. Only used at level 0.
+    """
+    cdef isal_gzip_header gz_hdr
+    cdef Py_ssize_t gz_hdr_size = 10
+    cdef bytes name_bytes
+    cdef bytes extra_bytes
+    isal_gzip_header_init(&gz_hdr)
+    if mtime is None:
+        mtime = time.time()
+    gz_hdr.time = <unsigned int>int(mtime)
+    # ISA-L has no best compression level, so only the fast level is flagged.
+    gz_hdr.xflags = 4 if level == ISAL_DEF_MIN_LEVEL else 0
+    # Unknown OS, like the header written by IGzipFile.
+    gz_hdr.os = 255
+    if name is not None:
+        name_bytes = bytes(name)
+        if b"\x00" in name_bytes:
+            raise ValueError("name must not contain null bytes")
+        # Cython adds the terminating null byte of a bytes object.
+        gz_hdr.name = name_bytes
+        gz_hdr.name_buf_len = len(name_bytes) + 1
+        gz_hdr_size += len(name_bytes) + 1
+    if extra is not None:
+        extra_bytes = bytes(extra)
+        if len(extra_bytes) > 0xFFFF:
+            raise ValueError("extra must be at most 65535 bytes")
+        gz_hdr.extra = <unsigned char *><char *>extra_bytes
+        gz_hdr.extra_len = len(extra_bytes)
+        gz_hdr.extra_buf_len = len(extra_bytes)
+        gz_hdr_size += len(extra_bytes) + 2
+
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+
+    cdef isal_zstream stream
+    cdef unsigned int level_buf_size
+    cdef bytearray level_buf_obj = None
+    try:
+        mem_level = resolve_mem_level(mem_level, buffer.len)
+        mem_level_to_bufsize(level, mem_level, &level_buf_size)
+        level_buf_obj = take_level_buf(level_buf_size)
+        isal_deflate_init(&stream)
+        stream.level = level
+        stream.level_buf = <unsigned char*>PyByteArray_AS_STRING(level_buf_obj)
+        stream.level_buf_size = level_buf_size
+        stream.hist_bits = hist_bits
+        # deflate_all writes the header from gz_hdr into the same output
+        # buffer. ISA-L writes the trailer.
+        stream.gzip_flag = IGZIP_GZIP_NO_HDR
+        set_hufftables(&stream, hufftables)
+        return deflate_all(&stream, buffer, &gz_hdr, gz_hdr_size)
     finally:
         PyBuffer_Release(buffer)
-        PyMem_Free(level_buf)
-        PyMem_Free(obuf)
+        if level_buf_obj is not None:
+            give_level_buf(level_buf_obj)
+
+
+def compress_into(data,
+                  out,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  int flag = IGZIP_DEFLATE,
+                  int mem_level = MEM_LEVEL_DEFAULT_I,
+                  int hist_bits = ISAL_DEF_MAX_HIST_BITS,
+                  ):
+    """
+    Compresses the bytes in *data* directly into the writable buffer *out*
+    (bytearray, memoryview, mmap etc.). Returns the number of bytes written.
+    An IsalError is raised when *out* is too small to hold the compressed
+    data.
+
+    The other parameters are the same as for :py:func:`compress`.
+    """
+    return _compress_into(data, out, level, flag, mem_level, hist_bits)
+
+
+cdef Py_ssize_t _compress_into(data,
+                               out,
+                               int level,
+                               int flag,
+                               int mem_level,
+                               int hist_bits,
+                               ) except -1:
+    # initialise input and output
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    cdef Py_buffer out_buffer_data
+    cdef Py_buffer* out_buffer = &out_buffer_data
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+    try:
+        PyObject_GetBuffer(out, out_buffer, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE)
+    except:
+        PyBuffer_Release(buffer)
+        raise
+
+    # Initialise stream
+    cdef isal_zstream stream
+    cdef unsigned int level_buf_size
+    cdef bytearray level_buf_obj = None
+    cdef Py_ssize_t ibuflen = buffer.len
+    cdef unsigned char * obuf = <unsigned char*>out_buffer.buf
+    cdef unsigned char * obuf_end = obuf + out_buffer.len
+    cdef int err
+
+    try:
+        mem_level = resolve_mem_level(mem_level, buffer.len)
+        mem_level_to_bufsize(level, mem_level, &level_buf_size)
+        level_buf_obj = take_level_buf(level_buf_size)
+        isal_deflate_init(&stream)
+        stream.level = level
+        stream.level_buf = <unsigned char*>PyByteArray_AS_STRING(level_buf_obj)
+        stream.level_buf_size = level_buf_size
+        stream.hist_bits = hist_bits
+        stream.gzip_flag = flag
+        stream.next_in = <unsigned char*>buffer.buf
+        stream.next_out = obuf
+        while True:
+            arrange_input_buffer(&stream, &ibuflen)
+            if ibuflen == 0:
+                stream.flush = FULL_FLUSH
+                stream.end_of_stream = 1
+            else:
+                stream.flush = NO_FLUSH
+
+            while True:
+                arrange_fixed_output_buffer(&stream, obuf_end)
+                if stream.avail_out == 0:
+                    raise IsalError("Output buffer is too small")
+                with nogil:
+                    err = isal_deflate(&stream)
+                if err != COMP_OK:
+                    check_isal_deflate_rc(err)
+                if (stream.avail_out != 0 or
+                        stream.internal_state.state == ZSTATE_END):
+                    break
+            if stream.avail_in != 0:
+                raise AssertionError("Input stream should be empty")
+            if stream.internal_state.state == ZSTATE_END:
+                break
+        return stream.next_out - obuf
+    finally:
+        PyBuffer_Release(buffer)
+        PyBuffer_Release(out_buffer)
+        if level_buf_obj is not None:
+            give_level_buf(level_buf_obj)
 
 
 def decompress(data,
@@ -281,11 +897,38 @@ def decompress(data,
                     is dynamically resized according to the need. The default
                     size is 16K. If a larger output is expected, using a 
                     larger buffer will improve performance by negating the 
-                    costs associated with the dynamic resizing.
+                    costs associated with the dynamic resizing. For gzip
+                    data the size stored in the gzip trailer is used when it
+                    is larger than bufsize.
     """
     return _decompress(data, flag, hist_bits, bufsize)
 
 
+# The maximum compression ratio of deflate is 1032:1. A size hint that
+# exceeds this can not be right.
+DEF MAX_DEFLATE_RATIO_I = 1032
+
+cdef Py_ssize_t gzip_trailer_size_hint(unsigned char *data,
+                                       Py_ssize_t length):
+    # The last four bytes of a gzip member are the uncompressed size modulo
+    # 2^32 (ISIZE). For a single member this is usually the exact size of
+    # the output. Returns 0 when no plausible hint is available.
+    if length < 8:
+        return 0
+    cdef unsigned char *isize_ptr = data + length - 4
+    cdef unsigned long long isize = (
+        <unsigned long long>isize_ptr[0] |
+        <unsigned long long>isize_ptr[1] << 8 |
+        <unsigned long long>isize_ptr[2] << 16 |
+        <unsigned long long>isize_ptr[3] << 24)
+    if (isize > <unsigned long long>length * MAX_DEFLATE_RATIO_I or
+            isize >= <unsigned long long>PY_SSIZE_T_MAX):
+        return 0
+    # One extra byte so the output buffer is not completely full when the
+    # trailer is read. Otherwise the buffer would be enlarged needlessly.
+    return isize + 1
+
+
 cdef _decompress(data,
                  int flag,
                  int hist_bits,
@@ -303,34 +946,708 @@ cdef _decompress(data,
     cdef Py_buffer* buffer = &buffer_data
     # Cython makes sure error is handled when acquiring buffer fails.
     PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+
+    try:
+        return inflate_all(&stream, buffer, bufsize)
+    finally:
+        PyBuffer_Release(buffer)
+
+
+cdef inflate_all(inflate_state *stream, Py_buffer *buffer, Py_ssize_t bufsize):
+    # Decompress a complete stream from the buffer and return it as a bytes
+    # object. The stream must be freshly initialised or reset.
+    cdef unsigned int flag = stream.crc_flag
+    cdef unsigned int hist_bits = stream.hist_bits
+
+    # initialise input
     cdef Py_ssize_t ibuflen = buffer.len
     stream.next_in =  <unsigned char*>buffer.buf
 
     # Initialise output buffer
-    cdef unsigned char * obuf = NULL
+    cdef PyObject * obuf = NULL
     cdef int err
+    cdef Py_ssize_t size_hint
+    if (flag == ISAL_GZIP or flag == ISAL_GZIP_NO_HDR or
+            flag == ISAL_GZIP_NO_HDR_VER):
+        size_hint = gzip_trailer_size_hint(<unsigned char*>buffer.buf,
+                                           buffer.len)
+        if size_hint > bufsize:
+            bufsize = size_hint
 
     try:
+        if ibuflen <= STATELESS_MAX_SIZE_I and 0 < bufsize <= UINT32_MAX:
+            result = decompress_stateless(stream, <unsigned char*>buffer.buf,
+                                          ibuflen, bufsize)
+            if result is not None:
+                return result
+            # Start over with streaming decompression.
+            isal_inflate_reset(stream)
+            stream.hist_bits = hist_bits
+            stream.crc_flag = flag
+            stream.next_in = <unsigned char*>buffer.buf
         while True:
-            arrange_input_buffer(&stream, &ibuflen)
+            arrange_input_buffer(stream, &ibuflen)
 
             while True:
-                bufsize = arrange_output_buffer(&stream, &obuf, bufsize)
+                bufsize = arrange_output_buffer(stream, &obuf, bufsize)
                 if bufsize == -1:
                     raise MemoryError("Unsufficient memory for buffer allocation")
-                err = isal_inflate(&stream)
+                with nogil:
+                    err = isal_inflate(stream)
                 if err != ISAL_DECOMP_OK:
                     check_isal_inflate_rc(err)
-                if stream.avail_out != 0:
+                if stream.avail_out != 0 or stream.block_state == ISAL_BLOCK_FINISH:
                     break
             if ibuflen == 0 or stream.block_state == ISAL_BLOCK_FINISH:
                 break
         if stream.block_state != ISAL_BLOCK_FINISH:
             raise IsalError("incomplete or truncated stream")
-        return PyBytes_FromStringAndSize(<char*>obuf, stream.next_out - obuf)
+        return output_buffer_to_bytes(stream, &obuf)
     finally:
+        Py_XDECREF(obuf)
+
+
+def decompress_into(data,
+                    out,
+                    int flag = ISAL_DEFLATE,
+                    int hist_bits=ISAL_DEF_MAX_HIST_BITS):
+    """
+    Decompresses the bytes in *data* directly into the writable buffer *out*
+    (bytearray, memoryview, mmap etc.). Returns the number of bytes written.
+    An IsalError is raised when *out* is too small to hold the decompressed
+    data.
+
+    The other parameters are the same as for :py:func:`decompress`.
+    """
+    return _decompress_into(data, out, flag, hist_bits)
+
+
+cdef Py_ssize_t _decompress_into(data,
+                                 out,
+                                 int flag,
+                                 int hist_bits) except -1:
+    cdef inflate_state stream
+    isal_inflate_init(&stream)
+    stream.hist_bits = hist_bits
+    stream.crc_flag = flag
+
+    # initialise input and output
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    cdef Py_buffer out_buffer_data
+    cdef Py_buffer* out_buffer = &out_buffer_data
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+    try:
+        PyObject_GetBuffer(out, out_buffer, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE)
+    except:
         PyBuffer_Release(buffer)
-        PyMem_Free(obuf)
+        raise
+    cdef Py_ssize_t ibuflen = buffer.len
+    stream.next_in = <unsigned char*>buffer.buf
+    cdef unsigned char * obuf = <unsigned char*>out_buffer.buf
+    cdef unsigned char * obuf_end = obuf + out_buffer.len
+    stream.next_out = obuf
+
+    cdef int err
+    cdef unsigned int avail_in_before
+    cdef unsigned char * next_out_before
+
+    try:
+        while True:
+            arrange_input_buffer(&stream, &ibuflen)
+
+            while True:
+                arrange_fixed_output_buffer(&stream, obuf_end)
+                avail_in_before = stream.avail_in
+                next_out_before = stream.next_out
+                with nogil:
+                    err = isal_inflate(&stream)
+                if err != ISAL_DECOMP_OK:
+                    check_isal_inflate_rc(err)
+                if stream.avail_out != 0 or stream.block_state == ISAL_BLOCK_FINISH:
+                    break
+                # The output buffer is full. ISA-L may still consume the
+                # trailer, so only give up when no progress was made at all.
+                if (stream.avail_in == avail_in_before and
+                        stream.next_out == next_out_before):
+                    raise IsalError("Output buffer is too small")
+            if ibuflen == 0 or stream.block_state == ISAL_BLOCK_FINISH:
+                break
+        if stream.block_state != ISAL_BLOCK_FINISH:
+            raise IsalError("incomplete or truncated stream")
+        return stream.next_out - obuf
+    finally:
+        PyBuffer_Release(buffer)
+        PyBuffer_Release(out_buffer)
+
+
+
+cdef struct batch_item:
+    unsigned char *data
+    Py_ssize_t length
+    PyObject *out
+    unsigned char *out_buf
+    Py_ssize_t out_length
+    unsigned int level_buf_size
+    int err
+
+
+cdef class _BufferBatch:
+    # The buffers of a sequence of objects and an output bytes object for
+    # each, so they can be processed without the GIL.
+    cdef Py_buffer *buffers
+    cdef batch_item *items
+    cdef Py_ssize_t count
+    cdef Py_ssize_t max_length
+
+    def __cinit__(self, objects):
+        if not isinstance(objects, (list, tuple)):
+            objects = list(objects)
+        cdef Py_ssize_t size = len(objects)
+        cdef Py_ssize_t i
+        self.buffers = <Py_buffer *>PyMem_Malloc(size * sizeof(Py_buffer))
+        self.items = <batch_item *>PyMem_Malloc(size * sizeof(batch_item))
+        if self.buffers == NULL or self.items == NULL:
+            raise MemoryError()
+        memset(self.items, 0, size * sizeof(batch_item))
+        self.max_length = 0
+        for i in range(size):
+            # Cython makes sure error is handled when acquiring buffer fails.
+            PyObject_GetBuffer(objects[i], &self.buffers[i],
+                               PyBUF_C_CONTIGUOUS)
+            self.count = i + 1
+            self.items[i].data = <unsigned char *>self.buffers[i].buf
+            self.items[i].length = self.buffers[i].len
+            if self.buffers[i].len > self.max_length:
+                self.max_length = self.buffers[i].len
+
+    def __dealloc__(self):
+        cdef Py_ssize_t i
+        for i in range(self.count):
+            PyBuffer_Release(&self.buffers[i])
+            Py_XDECREF(self.items[i].out)
+        PyMem_Free(self.buffers)
+        PyMem_Free(self.items)
+
+    cdef int allocate_output(self, Py_ssize_t i,
+                             Py_ssize_t length) except -1:
+        # Items that are too large for the stateless functions get no output
+        # here and are handled by the streaming functions instead.
+        if length > UINT32_MAX or self.items[i].length > UINT32_MAX:
+            return 0
+        self.items[i].out = new_bytes_buffer(NULL, length)
+        if self.items[i].out == NULL:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+        self.items[i].out_buf = <unsigned char *>PyBytes_AS_STRING(
+            self.items[i].out)
+        self.items[i].out_length = length
+        return 0
+
+    cdef int set_output(self, Py_ssize_t i, bytes result) except -1:
+        Py_XDECREF(self.items[i].out)
+        Py_INCREF(result)
+        self.items[i].out = <PyObject *>result
+        self.items[i].out_length = len(result)
+        return 0
+
+    cdef list results(self):
+        cdef list results = []
+        cdef Py_ssize_t i
+        for i in range(self.count):
+            if self.items[i].out_length != PyBytes_GET_SIZE(self.items[i].out):
+                if _PyBytes_Resize(&self.items[i].out,
+                                   self.items[i].out_length) < 0:
+                    raise MemoryError(
+                        "Unsufficient memory for buffer allocation")
+            results.append(<object>self.items[i].out)
+        return results
+
+
+cdef void deflate_items(isal_zstream *stream, batch_item *items,
+                        Py_ssize_t count) nogil:
+    # Compress every item with the stateless function into its output,
+    # which is large enough for incompressible data.
+    cdef Py_ssize_t i
+    for i in range(count):
+        if items[i].out_buf == NULL:
+            items[i].err = INVALID_PARAM
+            continue
+        isal_deflate_reset(stream)
+        stream.level_buf_size = items[i].level_buf_size
+        stream.next_in = items[i].data
+        stream.avail_in = <unsigned int>items[i].length
+        stream.next_out = items[i].out_buf
+        stream.avail_out = <unsigned int>items[i].out_length
+        stream.flush = NO_FLUSH
+        stream.end_of_stream = 1
+        items[i].err = isal_deflate_stateless(stream)
+        items[i].out_length = stream.next_out - items[i].out_buf
+
+
+cdef void inflate_items(inflate_state *stream, int flag, int hist_bits,
+                        batch_item *items, Py_ssize_t count) nogil:
+    # Decompress every item with the stateless function. Items whose output
+    # does not fit keep an error and are handled with the GIL.
+    cdef Py_ssize_t i
+    for i in range(count):
+        if items[i].out_buf == NULL:
+            items[i].err = ISAL_INVALID_BLOCK
+            continue
+        isal_inflate_init(stream)
+        stream.hist_bits = hist_bits
+        stream.crc_flag = flag
+        stream.next_in = items[i].data
+        stream.avail_in = <unsigned int>items[i].length
+        stream.next_out = items[i].out_buf
+        stream.avail_out = <unsigned int>items[i].out_length
+        items[i].err = isal_inflate_stateless(stream)
+        items[i].out_length = stream.next_out - items[i].out_buf
+
+
+cdef class _DeflateWorker:
+    # Compresses a range of the items of a batch with its own stream.
+    cdef isal_zstream stream
+    cdef bytearray level_buf
+    cdef batch_item *items
+    cdef Py_ssize_t count
+
+    def run(self):
+        with nogil:
+            deflate_items(&self.stream, self.items, self.count)
+
+
+cdef class _InflateWorker:
+    # Decompresses a range of the items of a batch with its own state.
+    cdef inflate_state stream
+    cdef int flag
+    cdef int hist_bits
+    cdef batch_item *items
+    cdef Py_ssize_t count
+
+    def run(self):
+        with nogil:
+            inflate_items(&self.stream, self.flag, self.hist_bits,
+                          self.items, self.count)
+
+
+cdef run_workers(list workers):
+    # The first worker runs on the calling thread, the others each on their
+    # own thread.
+    threads = [threading.Thread(target=worker.run) for worker in workers[1:]]
+    for thread in threads:
+        thread.start()
+    try:
+        workers[0].run()
+    finally:
+        for thread in threads:
+            thread.join()
+
+
+cdef Py_ssize_t batch_workers(Py_ssize_t count, threads) except -1:
+    if threads < 1:
+        raise ValueError("threads must be at least 1, got %s" % threads)
+    if count < threads:
+        return count
+    return threads
+
+
+def compress_many(buffers,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  int flag=IGZIP_DEFLATE,
+                  int mem_level=MEM_LEVEL_DEFAULT_I,
+                  int hist_bits=ISAL_DEF_MAX_HIST_BITS,
+                  hufftables=None,
+                  threads=1):
+    """
+    Compresses every buffer in the sequence *buffers* independently and
+    returns a list with the compressed data of each. Gives the same result
+    as calling :py:func:`compress` for each buffer, but the buffers are
+    compressed in one loop without the GIL, using one compression state per
+    thread. Like :py:func:`compress`, buffers larger than 64K are compressed
+    with the streaming functions. This happens afterwards, on one thread.
+
+    :param mem_level: As for :py:func:`compress`. MEM_LEVEL_AUTO is resolved
+                      for each buffer separately.
+    :param threads: The number of threads over which the buffers are
+                    divided.
+
+    The other parameters are the same as for :py:func:`compress`.
+    """
+    cdef _BufferBatch batch = _BufferBatch(buffers)
+    cdef Py_ssize_t count = batch.count
+    cdef Py_ssize_t i, start
+    cdef Py_ssize_t n_workers = batch_workers(count, threads)
+    cdef unsigned int level_buf_size = 0
+    cdef _DeflateWorker worker
+    if count == 0:
+        return []
+    # The level buffer of each worker is large enough for every item. The
+    # size that compress would use is set per item, as it affects the output.
+    for i in range(count):
+        mem_level_to_bufsize(
+            level, resolve_mem_level(mem_level, batch.items[i].length),
+            &batch.items[i].level_buf_size)
+        if batch.items[i].level_buf_size > level_buf_size:
+            level_buf_size = batch.items[i].level_buf_size
+        if batch.items[i].length <= STATELESS_MAX_SIZE_I:
+            batch.allocate_output(i, deflate_bound(batch.items[i].length))
+    cdef list workers = []
+    try:
+        for i in range(n_workers):
+            worker = _DeflateWorker()
+            worker.level_buf = take_level_buf(level_buf_size)
+            isal_deflate_init(&worker.stream)
+            worker.stream.level = level
+            worker.stream.level_buf = <unsigned char *>PyByteArray_AS_STRING(
+                worker.level_buf)
+            worker.stream.level_buf_size = level_buf_size
+            worker.stream.hist_bits = hist_bits
+            worker.stream.gzip_flag = flag
+            set_hufftables(&worker.stream, hufftables)
+            start = count * i // n_workers
+            worker.items = batch.items + start
+            worker.count = count * (i + 1) // n_workers - start
+            workers.append(worker)
+        run_workers(workers)
+        # Compress items that failed again with the streaming function. That
+        # gives the same result and errors as compress.
+        worker = workers[0]
+        for i in range(count):
+            if batch.items[i].err != COMP_OK:
+                isal_deflate_reset(&worker.stream)
+                worker.stream.level_buf_size = batch.items[i].level_buf_size
+                batch.set_output(i, deflate_all(&worker.stream,
+                                                &batch.buffers[i]))
+        return batch.results()
+    finally:
+        for worker in workers:
+            give_level_buf(worker.level_buf)
+
+
+def decompress_many(buffers,
+                    int flag=ISAL_DEFLATE,
+                    int hist_bits=ISAL_DEF_MAX_HIST_BITS,
+                    Py_ssize_t bufsize=DEF_BUF_SIZE,
+                    threads=1):
+    """
+    Decompresses every buffer in the sequence *buffers* independently and
+    returns a list with the decompressed data of each. Gives the same result
+    as calling :py:func:`decompress` for each buffer, but the buffers are
+    decompressed in one loop without the GIL.
+
+    :param bufsize: The output buffer size for each buffer. For gzip data
+                    the size in the trailer is used when it is larger.
+                    Buffers whose output does not fit are decompressed again
+                    with a growing output buffer.
+    :param threads: The number of threads over which the buffers are
+                    divided.
+
+    The other parameters are the same as for :py:func:`decompress`.
+    """
+    if bufsize < 0:
+        raise ValueError("bufsize must be non-negative")
+    cdef _BufferBatch batch = _BufferBatch(buffers)
+    cdef Py_ssize_t count = batch.count
+    cdef Py_ssize_t i, start, size_hint
+    cdef Py_ssize_t n_workers = batch_workers(count, threads)
+    cdef _InflateWorker worker
+    cdef bint is_gzip = (flag == ISAL_GZIP or flag == ISAL_GZIP_NO_HDR or
+                         flag == ISAL_GZIP_NO_HDR_VER)
+    if count == 0:
+        return []
+    for i in range(count):
+        size_hint = bufsize
+        if is_gzip:
+            size_hint = gzip_trailer_size_hint(batch.items[i].data,
+                                               batch.items[i].length)
+            if size_hint < bufsize:
+                size_hint = bufsize
+        batch.allocate_output(i, size_hint)
+    cdef list workers = []
+    for i in range(n_workers):
+        worker = _InflateWorker()
+        worker.flag = flag
+        worker.hist_bits = hist_bits
+        start = count * i // n_workers
+        worker.items = batch.items + start
+        worker.count = count * (i + 1) // n_workers - start
+        workers.append(worker)
+    run_workers(workers)
+    # Output that did not fit, and errors, are handled by the streaming
+    # function so they are the same as for decompress.
+    worker = workers[0]
+    for i in range(count):
+        if batch.items[i].err != ISAL_DECOMP_OK:
+            isal_inflate_init(&worker.stream)
+            worker.stream.hist_bits = hist_bits
+            worker.stream.crc_flag = flag
+            batch.set_output(i, inflate_all(&worker.stream, &batch.buffers[i],
+                                            bufsize))
+    return batch.results()
+
+
+cdef class Compressor:
+    """
+    Reusable context for compressing many independent messages.
+
+    Unlike :py:func:`compress`, the compression state and the level buffer
+    are allocated only once, when the object is created. Every call to
+    :py:meth:`compress` returns a complete compressed stream that does not
+    depend on previous calls.
+
+    The parameters are the same as for :py:func:`compress`.
+    """
+    cdef isal_zstream stream
+    cdef unsigned char * level_buf
+    cdef PyThread_type_lock lock
+    cdef object hufftables
+
+    def __cinit__(self,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  int flag = IGZIP_DEFLATE,
+                  int mem_level = MEM_LEVEL_DEFAULT_I,
+                  int hist_bits = ISAL_DEF_MAX_HIST_BITS,
+                  hufftables = None):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
+        cdef unsigned int level_buf_size
+        if mem_level_to_bufsize(level, mem_level, &level_buf_size) != 0:
+            raise ValueError("Invalid compression level or memory level")
+        self.level_buf = <unsigned char *>PyMem_Malloc(level_buf_size * sizeof(char))
+        if self.level_buf == NULL:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+        isal_deflate_init(&self.stream)
+        self.stream.level = level
+        self.stream.level_buf = self.level_buf
+        self.stream.level_buf_size = level_buf_size
+        self.stream.hist_bits = hist_bits
+        self.stream.gzip_flag = flag
+        set_hufftables(&self.stream, hufftables)
+        self.hufftables = hufftables
+
+    def __dealloc__(self):
+        if self.level_buf != NULL:
+            PyMem_Free(self.level_buf)
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
+
+    def compress(self, data):
+        """
+        Compresses the bytes in *data*. Returns a bytes object with the
+        compressed data.
+        """
+        cdef Py_buffer buffer_data
+        cdef Py_buffer* buffer = &buffer_data
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+        acquire_lock(self.lock)
+        try:
+            isal_deflate_reset(&self.stream)
+            return deflate_all(&self.stream, buffer)
+        finally:
+            PyBuffer_Release(buffer)
+            PyThread_release_lock(self.lock)
+
+    def reset(self):
+        """
+        Reset the compression state. This is done automatically at the start
+        of every :py:meth:`compress` call.
+        """
+        acquire_lock(self.lock)
+        isal_deflate_reset(&self.stream)
+        PyThread_release_lock(self.lock)
+
+
+cdef class Decompressor:
+    """
+    Reusable context for decompressing many independent messages.
+
+    Unlike :py:func:`decompress`, the decompression state is allocated only
+    once, when the object is created. Every call to :py:meth:`decompress`
+    expects a complete compressed stream.
+
+    The parameters are the same as for :py:func:`decompress`.
+    """
+    cdef inflate_state stream
+    cdef unsigned int flag
+    cdef unsigned int hist_bits
+    cdef PyThread_type_lock lock
+
+    def __cinit__(self,
+                  int flag = ISAL_DEFLATE,
+                  int hist_bits = ISAL_DEF_MAX_HIST_BITS):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
+        self.flag = flag
+        self.hist_bits = hist_bits
+        isal_inflate_init(&self.stream)
+        self.stream.hist_bits = hist_bits
+        self.stream.crc_flag = flag
+
+    def __dealloc__(self):
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
+
+    cdef void reset_stream(self):
+        isal_inflate_reset(&self.stream)
+        self.stream.hist_bits = self.hist_bits
+        self.stream.crc_flag = self.flag
+
+    def decompress(self, data, Py_ssize_t bufsize=DEF_BUF_SIZE):
+        """
+        Decompresses the bytes in *data*. Returns a bytes object with the
+        decompressed data.
+
+        :param bufsize: The initial size of the output buffer.
+        """
+        if bufsize < 0:
+            raise ValueError("bufsize must be non-negative")
+        cdef Py_buffer buffer_data
+        cdef Py_buffer* buffer = &buffer_data
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+        acquire_lock(self.lock)
+        try:
+            self.reset_stream()
+            return inflate_all(&self.stream, buffer, bufsize)
+        finally:
+            PyBuffer_Release(buffer)
+            PyThread_release_lock(self.lock)
+
+    def reset(self):
+        """
+        Reset the decompression state. This is done automatically at the
+        start of every :py:meth:`decompress` call.
+        """
+        acquire_lock(self.lock)
+        self.reset_stream()
+        PyThread_release_lock(self.lock)
+
+
+cdef class IgzipCompressor:
+    """
+    Compress object for handling streaming compression.
+
+    The parameters are the same as for :py:func:`compress`. With
+    COMP_GZIP_NO_HDR, ISA-L keeps track of the checksum and the size of the
+    data and writes the gzip trailer when the stream is finished.
+    """
+    cdef isal_zstream stream
+    cdef unsigned char * level_buf
+    cdef bint finished
+    cdef PyThread_type_lock lock
+    cdef object hufftables
+
+    def __cinit__(self,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  int flag = IGZIP_DEFLATE,
+                  int mem_level = MEM_LEVEL_DEFAULT_I,
+                  int hist_bits = ISAL_DEF_MAX_HIST_BITS,
+                  hufftables = None):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
+        cdef unsigned int level_buf_size
+        if mem_level_to_bufsize(level, mem_level, &level_buf_size) != 0:
+            raise ValueError("Invalid compression level or memory level")
+        self.level_buf = <unsigned char *>PyMem_Malloc(level_buf_size * sizeof(char))
+        if self.level_buf == NULL:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+        isal_deflate_init(&self.stream)
+        self.stream.level = level
+        self.stream.level_buf = self.level_buf
+        self.stream.level_buf_size = level_buf_size
+        self.stream.hist_bits = hist_bits
+        self.stream.gzip_flag = flag
+        set_hufftables(&self.stream, hufftables)
+        self.hufftables = hufftables
+        self.finished = False
+
+    def __dealloc__(self):
+        if self.level_buf != NULL:
+            PyMem_Free(self.level_buf)
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
+
+    cdef deflate_data(self, unsigned char *data, Py_ssize_t length):
+        # Deflate the data with the current flush settings of the stream.
+        cdef PyObject *obuf = NULL
+        cdef Py_ssize_t obuflen = DEF_BUF_SIZE_I
+        cdef int err
+        if self.finished:
+            raise ValueError("Compressor has already been finished")
+        try:
+            self.stream.next_in = data
+            while True:
+                arrange_input_buffer(&self.stream, &length)
+                while True:
+                    obuflen = arrange_output_buffer(&self.stream, &obuf, obuflen)
+                    if obuflen == -1:
+                        raise MemoryError("Unsufficient memory for buffer allocation")
+                    with nogil:
+                        err = isal_deflate(&self.stream)
+                    if err != COMP_OK:
+                        check_isal_deflate_rc(err)
+                    if self.stream.avail_out != 0:
+                        break
+                if length == 0:
+                    break
+            return output_buffer_to_bytes(&self.stream, &obuf)
+        finally:
+            Py_XDECREF(obuf)
+
+    def compress(self, data):
+        """
+        Compress *data* returning a bytes object with at least part of the
+        data in *data*. Some input may be kept in internal buffers for later
+        processing.
+        """
+        cdef Py_buffer buffer_data
+        cdef Py_buffer* buffer = &buffer_data
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+        acquire_lock(self.lock)
+        try:
+            self.stream.flush = NO_FLUSH
+            return self.deflate_data(<unsigned char *>buffer.buf, buffer.len)
+        finally:
+            PyBuffer_Release(buffer)
+            PyThread_release_lock(self.lock)
+
+    def flush(self, int mode=SYNC_FLUSH):
+        """
+        Compress all pending input and return the compressed data. The stream
+        can be continued afterwards.
+
+        :param mode: ISAL_SYNC_FLUSH or ISAL_FULL_FLUSH. After a full flush
+                     the data that follows does not refer to earlier data.
+        """
+        if mode != SYNC_FLUSH and mode != FULL_FLUSH:
+            raise ValueError("Unsupported flush mode")
+        acquire_lock(self.lock)
+        try:
+            self.stream.flush = mode
+            return self.deflate_data(NULL, 0)
+        finally:
+            PyThread_release_lock(self.lock)
+
+    def finish(self):
+        """
+        Compress all pending input and end the stream, including the trailer
+        for the gzip and zlib flags. Return the remaining compressed data.
+        """
+        acquire_lock(self.lock)
+        try:
+            self.stream.flush = FULL_FLUSH
+            self.stream.end_of_stream = 1
+            result = self.deflate_data(NULL, 0)
+            self.finished = True
+            return result
+        finally:
+            PyThread_release_lock(self.lock)
 
 
 cdef bytes view_bitbuffer(inflate_state * stream):
@@ -356,15 +1673,21 @@ cdef class IgzipDecompressor:
     cdef unsigned char * input_buffer
     cdef size_t input_buffer_size
     cdef Py_ssize_t avail_in_real
+    cdef PyThread_type_lock lock
 
     def __dealloc__(self):
         if self.input_buffer != NULL:
             PyMem_Free(self.input_buffer)
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
 
     def __cinit__(self,
                   flag=ISAL_DEFLATE,
                   hist_bits=ISAL_DEF_MAX_HIST_BITS,
                   zdict = None):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
         isal_inflate_init(&self.stream)
 
         self.stream.hist_bits = hist_bits
@@ -384,14 +1707,78 @@ cdef class IgzipDecompressor:
         self.avail_in_real = 0
         self.needs_input = True
         
+    @property
+    def crc(self):
+        """The checksum of the decompressed data so far. Only computed
+        when a gzip or zlib flag is used."""
+        return self.stream.crc
+
     def _view_bitbuffer(self):
         """Shows the 64-bitbuffer of the internal inflate_state. It contains
         a maximum of 8 bytes. This data is already read-in so is not part
         of the unconsumed tail."""
         return view_bitbuffer(&self.stream)
 
-    cdef decompress_buf(self, Py_ssize_t max_length, unsigned char ** obuf):
-        obuf[0] = NULL
+    def _get_state(self):
+        """Return the state at a deflate block boundary as a tuple of the
+        bits that were read in but not used, the number of those bits and the
+        number of input bytes held back for the next block header. Together
+        with the last 32K of output this is enough to resume decompression
+        with _set_state. Returns None when the decompressor is not waiting
+        for input at a block boundary."""
+        acquire_lock(self.lock)
+        try:
+            if (self.eof or not self.needs_input or
+                    (self.stream.block_state != ISAL_BLOCK_NEW_HDR and
+                     self.stream.block_state != ISAL_BLOCK_HDR) or
+                    self.stream.tmp_out_processed != self.stream.tmp_out_valid):
+                return None
+            return (self.stream.read_in, self.stream.read_in_length,
+                    self.stream.tmp_in_size)
+        finally:
+            PyThread_release_lock(self.lock)
+
+    def _set_state(self, unsigned long long bits, int bit_count, window,
+                   unsigned int crc):
+        """Resume decompression at a deflate block boundary saved with
+        _get_state. window contains the output before the boundary, of which
+        the last 32K is used, and crc the checksum of the output so far. Can
+        only be called before any data was decompressed."""
+        if bit_count < 0 or bit_count > 64:
+            raise ValueError("bit_count must be between 0 and 64")
+        if bit_count < 64:
+            bits &= (<unsigned long long>1 << bit_count) - 1
+        cdef Py_buffer buffer_data
+        cdef Py_buffer* buffer = &buffer_data
+        cdef int err
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(window, buffer, PyBUF_C_CONTIGUOUS)
+        acquire_lock(self.lock)
+        try:
+            if (self.stream.block_state != ISAL_BLOCK_NEW_HDR or
+                    self.stream.total_out != 0 or
+                    self.stream.tmp_out_valid != 0 or
+                    self.stream.read_in_length != 0):
+                raise ValueError("State can only be set before decompressing")
+            if buffer.len > IGZIP_HIST_SIZE:
+                err = isal_inflate_set_dict(
+                    &self.stream,
+                    <unsigned char *>buffer.buf + buffer.len - IGZIP_HIST_SIZE,
+                    IGZIP_HIST_SIZE)
+            else:
+                err = isal_inflate_set_dict(
+                    &self.stream, <unsigned char *>buffer.buf,
+                    <unsigned int>buffer.len)
+            if err != COMP_OK:
+                check_isal_deflate_rc(err)
+            self.stream.read_in = bits
+            self.stream.read_in_length = bit_count
+            self.stream.crc = crc
+        finally:
+            PyThread_release_lock(self.lock)
+            PyBuffer_Release(buffer)
+
+    cdef decompress_buf(self, Py_ssize_t max_length, PyObject ** obuf):
         cdef Py_ssize_t obuflen = DEF_BUF_SIZE_I
         cdef int err
         if obuflen > max_length:
@@ -403,7 +1790,30 @@ cdef class IgzipDecompressor:
             elif obuflen == -2:
                 break
             arrange_input_buffer(&self.stream, &self.avail_in_real)
-            err = isal_inflate(&self.stream)
+            with nogil:
+                err = isal_inflate(&self.stream)
+            self.avail_in_real += self.stream.avail_in
+            if err != ISAL_DECOMP_OK:
+                check_isal_inflate_rc(err)
+            if self.stream.block_state == ISAL_BLOCK_FINISH:
+                self.eof = 1
+                break
+            elif self.avail_in_real == 0:
+                break
+        return
+
+    cdef decompress_buf_into(self, unsigned char * obuf, Py_ssize_t obuflen):
+        # Same as decompress_buf, but writes into a fixed size buffer.
+        cdef unsigned char * obuf_end = obuf + obuflen
+        cdef int err
+        self.stream.next_out = obuf
+        while True:
+            if self.stream.next_out == obuf_end:
+                break
+            arrange_fixed_output_buffer(&self.stream, obuf_end)
+            arrange_input_buffer(&self.stream, &self.avail_in_real)
+            with nogil:
+                err = isal_inflate(&self.stream)
             self.avail_in_real += self.stream.avail_in
             if err != ISAL_DECOMP_OK:
                 check_isal_inflate_rc(err)
@@ -423,15 +1833,38 @@ cdef class IgzipDecompressor:
         :param max_length: if non-zero then the return value will be no longer
                            than max_length.
         """
-        if self.eof:
-            raise EOFError("End of stream already reached")
-        cdef bint input_buffer_in_use
-        
         cdef Py_ssize_t hard_limit
         if max_length < 0:
             hard_limit = PY_SSIZE_T_MAX
         else:
             hard_limit = max_length
+        return self.decompress_impl(data, hard_limit, NULL)
+
+    def decompress_into(self, data, out):
+        """
+        Decompress data directly into the writable buffer *out* (bytearray,
+        memoryview, mmap etc.). Returns the number of bytes written, which is
+        at most the length of *out*. Otherwise the same as
+        :py:meth:`decompress` with max_length set to the length of *out*.
+
+        :param data: Binary data (bytes, bytearray, memoryview).
+        :param out: A writable buffer.
+        """
+        cdef Py_buffer out_buffer_data
+        cdef Py_buffer* out_buffer = &out_buffer_data
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(out, out_buffer, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE)
+        try:
+            return self.decompress_impl(data, out_buffer.len, out_buffer)
+        finally:
+            PyBuffer_Release(out_buffer)
+
+    cdef decompress_impl(self, data, Py_ssize_t hard_limit, Py_buffer *out):
+        # Returns bytes when out is NULL. Otherwise the output is written to
+        # out and the number of bytes written is returned.
+        if self.eof:
+            raise EOFError("End of stream already reached")
+        cdef bint input_buffer_in_use
 
         cdef unsigned int avail_now
         cdef unsigned int avail_total
@@ -447,8 +1880,11 @@ cdef class IgzipDecompressor:
         cdef unsigned char * tmp
         cdef size_t offset
         # Initialise output buffer
-        cdef unsigned char *obuf = NULL
+        cdef PyObject *obuf = NULL
 
+        # The stream and the internal input buffer are used without the GIL.
+        # Only one thread may use them at a time.
+        acquire_lock(self.lock)
         try:
             if self.stream.next_in != NULL:
                 avail_now = (self.input_buffer + self.input_buffer_size) - \
@@ -475,10 +1911,13 @@ cdef class IgzipDecompressor:
                 self.avail_in_real = ibuflen
                 input_buffer_in_use = 0
 
-            self.decompress_buf(hard_limit, &obuf)
-            if obuf == NULL:
-                self.stream.next_in = NULL
-                return b""
+            if out == NULL:
+                self.decompress_buf(hard_limit, &obuf)
+                if obuf == NULL:
+                    self.stream.next_in = NULL
+                    return b""
+            else:
+                self.decompress_buf_into(<unsigned char *>out.buf, out.len)
             if self.eof:
                 self.needs_input = False
                 new_data = PyBytes_FromStringAndSize(<char *>self.stream.next_in, self.avail_in_real)
@@ -505,19 +1944,485 @@ cdef class IgzipDecompressor:
                     # Copy tail
                     memcpy(self.input_buffer, self.stream.next_in, self.avail_in_real)
                     self.stream.next_in = self.input_buffer
-            return PyBytes_FromStringAndSize(<char*>obuf, self.stream.next_out - obuf)
+            if out != NULL:
+                return self.stream.next_out - <unsigned char *>out.buf
+            return output_buffer_to_bytes(&self.stream, &obuf)
         except:
             self.stream.next_in = NULL
             raise
         finally:
             PyBuffer_Release(buffer)
-            PyMem_Free(obuf)
+            PyThread_release_lock(self.lock)
+            Py_XDECREF(obuf)
+
+
+# The default amount of compressed data that GzipReader reads at once.
+DEF READER_BUF_SIZE_I = 128 * 1024
+# GzipReader keeps this many of the consumed input bytes in front of next_in.
+# These include any whole bytes in the 64-bit bit buffer of inflate.
+DEF READER_HISTORY_I = 8
+# Start size of the buffers for the optional gzip header fields.
+DEF HEADER_FIELD_SIZE_I = 256
+
+DEF MEMBER_HEADER_I = 0
+DEF MEMBER_DATA_I = 1
+DEF MEMBER_TRAILER_I = 2
+
+cdef int grow_header_field(char **field, unsigned int *field_len) except -1:
+    cdef char *tmp = <char *>PyMem_Realloc(field[0], field_len[0] * 2)
+    if tmp == NULL:
+        raise MemoryError()
+    field[0] = tmp
+    field_len[0] *= 2
+    return 0
+
+
+cdef class GzipReader:
+    """
+    Read the decompressed data of a gzip file with one or more members.
+
+    Headers and trailers are parsed natively and compressed data is read into
+    an internal buffer, so no Python objects are created for each chunk.
+
+    :param fp: A binary file object positioned at the start of the gzip data.
+    :param buffersize: The amount of compressed data read at once.
+    """
+    cdef object fp
+    cdef object fp_readinto
+    cdef bytearray input_buffer
+    cdef inflate_state stream
+    cdef isal_gzip_header header
+    cdef int member_state
+    cdef unsigned long long pos
+    cdef readonly object mtime
+    cdef PyThread_type_lock lock
+
+    def __cinit__(self, fp, Py_ssize_t buffersize=READER_BUF_SIZE_I):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
+        # A trailer must fit in the buffer.
+        if not 8 <= buffersize <= UINT32_MAX:
+            raise ValueError("buffersize must be between 8 and %d"
+                             % UINT32_MAX)
+        isal_gzip_header_init(&self.header)
+        self.header.name = <char *>PyMem_Malloc(HEADER_FIELD_SIZE_I)
+        self.header.comment = <char *>PyMem_Malloc(HEADER_FIELD_SIZE_I)
+        self.header.extra = <unsigned char *>PyMem_Malloc(HEADER_FIELD_SIZE_I)
+        if (self.header.name == NULL or self.header.comment == NULL or
+                self.header.extra == NULL):
+            raise MemoryError()
+        self.header.name_buf_len = HEADER_FIELD_SIZE_I
+        self.header.comment_buf_len = HEADER_FIELD_SIZE_I
+        self.header.extra_buf_len = HEADER_FIELD_SIZE_I
+        isal_inflate_init(&self.stream)
+        self.fp = fp
+        self.fp_readinto = getattr(fp, "readinto", None)
+        self.input_buffer = bytearray(READER_HISTORY_I + buffersize)
+        self.mtime = None
+        self.reset_input()
+
+    def __dealloc__(self):
+        PyMem_Free(self.header.name)
+        PyMem_Free(self.header.comment)
+        PyMem_Free(self.header.extra)
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
+
+    cdef void reset_input(self):
+        self.stream.next_in = (
+            <unsigned char *>PyByteArray_AS_STRING(self.input_buffer) +
+            READER_HISTORY_I)
+        self.stream.avail_in = 0
+        self.member_state = MEMBER_HEADER_I
+        self.pos = 0
+
+    def tell(self):
+        """Return the number of decompressed bytes read so far."""
+        return self.pos
+
+    def rewind(self):
+        """Seek the file object back to the start and read from the first
+        member again."""
+        acquire_lock(self.lock)
+        try:
+            self.fp.seek(0)
+            self.reset_input()
+        finally:
+            PyThread_release_lock(self.lock)
+
+    cdef Py_ssize_t read_input(self, Py_ssize_t start) except -1:
+        # Read from the file into the input buffer from start up to its end.
+        cdef Py_ssize_t length = len(self.input_buffer) - start
+        cdef bytes data
+        if self.fp_readinto is not None:
+            read = self.fp_readinto(memoryview(self.input_buffer)[start:])
+            # None is returned by non-blocking files without data.
+            return read or 0
+        data = self.fp.read(length)
+        if len(data) > length:
+            raise ValueError("read() returned too much data")
+        memcpy(PyByteArray_AS_STRING(self.input_buffer) + start,
+               <char *>data, len(data))
+        return len(data)
+
+    cdef Py_ssize_t fill_input(self, Py_ssize_t needed) except -1:
+        # Make at least needed bytes of input available, unless the file ends
+        # first. Return the number of bytes available.
+        cdef unsigned char *buf = <unsigned char *>PyByteArray_AS_STRING(
+            self.input_buffer)
+        cdef Py_ssize_t read
+        cdef Py_ssize_t history
+        while self.stream.avail_in < needed:
+            # The bytes in front of next_in move along, so the bytes in the
+            # bit buffer can be given back in finish_member. After that, fewer
+            # than READER_HISTORY_I bytes may be in front of next_in.
+            history = py_ssize_t_min(self.stream.next_in - buf,
+                                     READER_HISTORY_I)
+            memmove(buf + READER_HISTORY_I - history,
+                    self.stream.next_in - history,
+                    history + self.stream.avail_in)
+            self.stream.next_in = buf + READER_HISTORY_I
+            read = self.read_input(READER_HISTORY_I + self.stream.avail_in)
+            if read == 0:
+                break
+            self.stream.avail_in += read
+        return self.stream.avail_in
+
+    cdef int start_member(self) except -1:
+        # Read the header of the next member. Return 0 at the end of the file.
+        cdef Py_ssize_t available = self.fill_input(3)
+        cdef unsigned char *data = self.stream.next_in
+        cdef unsigned int avail_in
+        cdef int err
+        if available == 0:
+            return 0
+        # The magic and method are checked here to give the same errors as
+        # the gzip module.
+        if available < 2:
+            raise EOFError("Compressed file ended before the end-of-stream "
+                           "marker was reached")
+        if data[0] != 0x1f or data[1] != 0x8b:
+            raise BadGzipFile("Not a gzipped file (%r)" %
+                              PyBytes_FromStringAndSize(<char *>data, 2))
+        if available < 3:
+            raise EOFError("Compressed file ended before the end-of-stream "
+                           "marker was reached")
+        if data[2] != 8:
+            raise BadGzipFile("Unknown compression method")
+        avail_in = self.stream.avail_in
+        isal_inflate_reset(&self.stream)
+        self.stream.hist_bits = ISAL_DEF_MAX_HIST_BITS
+        # Inflate computes the CRC of the output while it is still in the
+        # cache. The trailer is left to finish_member, which gives the same
+        # errors as the gzip module.
+        self.stream.crc_flag = ISAL_GZIP_NO_HDR
+        self.stream.crc = 0
+        self.stream.total_out = 0
+        self.stream.next_in = data
+        self.stream.avail_in = avail_in
+        while True:
+            err = isal_read_gzip_header(&self.stream, &self.header)
+            if err == ISAL_DECOMP_OK:
+                break
+            # The header parser continues where it stopped after more input
+            # is given or a field buffer is enlarged.
+            elif err == ISAL_END_INPUT:
+                if self.fill_input(1) == 0:
+                    raise EOFError("Compressed file ended before the "
+                                   "end-of-stream marker was reached")
+            elif err == ISAL_NAME_OVERFLOW:
+                grow_header_field(&self.header.name,
+                                  &self.header.name_buf_len)
+            elif err == ISAL_COMMENT_OVERFLOW:
+                grow_header_field(&self.header.comment,
+                                  &self.header.comment_buf_len)
+            elif err == ISAL_EXTRA_OVERFLOW:
+                grow_header_field(<char **>&self.header.extra,
+                                  &self.header.extra_buf_len)
+            elif err == ISAL_INCORRECT_CHECKSUM:
+                raise BadGzipFile("Corrupted header. Checksums do not match")
+            else:
+                check_isal_inflate_rc(err)
+        self.mtime = self.header.time
+        self.member_state = MEMBER_DATA_I
+        return 1
+
+    cdef int finish_member(self) except -1:
+        # Check the trailer of the member that was decompressed and skip the
+        # zero padding that may follow it.
+        cdef unsigned int unused = self.stream.read_in_length // 8
+        cdef unsigned char *data
+        cdef unsigned int crc
+        cdef unsigned int isize
+        # Whole bytes in the bit buffer are not part of the deflate stream.
+        # They are the last bytes that were consumed, which are still in
+        # front of next_in.
+        self.stream.next_in -= unused
+        self.stream.avail_in += unused
+        self.stream.read_in = 0
+        self.stream.read_in_length = 0
+        if self.fill_input(8) < 8:
+            raise EOFError("Compressed file ended before the end-of-stream "
+                           "marker was reached")
+        data = self.stream.next_in
+        crc = (data[0] | data[1] << 8 | data[2] << 16 |
+               <unsigned int>data[3] << 24)
+        isize = (data[4] | data[5] << 8 | data[6] << 16 |
+                 <unsigned int>data[7] << 24)
+        self.stream.next_in += 8
+        self.stream.avail_in -= 8
+        self.member_state = MEMBER_HEADER_I
+        if crc != self.stream.crc:
+            raise BadGzipFile("CRC check failed %s != %s" % (
+                hex(crc), hex(self.stream.crc)))
+        # total_out wraps around at 4GiB like the size in the trailer.
+        if isize != self.stream.total_out:
+            raise BadGzipFile("Incorrect length of data produced")
+        while self.fill_input(1) and self.stream.next_in[0] == 0:
+            self.stream.next_in += 1
+            self.stream.avail_in -= 1
+        return 0
+
+    def readinto(self, b):
+        """
+        Decompress data into the writable buffer b. Return the number of bytes
+        written, which is 0 at the end of the file.
+        """
+        cdef Py_buffer out_buffer_data
+        cdef Py_buffer* out_buffer = &out_buffer_data
+        # Cython makes sure error is handled when acquiring buffer fails.
+        PyObject_GetBuffer(b, out_buffer, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE)
+        acquire_lock(self.lock)
+        try:
+            return self.readinto_impl(<unsigned char *>out_buffer.buf,
+                                      out_buffer.len)
+        finally:
+            PyThread_release_lock(self.lock)
+            PyBuffer_Release(out_buffer)
+
+    cdef Py_ssize_t readinto_impl(self, unsigned char *obuf,
+                                  Py_ssize_t obuflen) except -1:
+        cdef unsigned int avail_in_before
+        cdef Py_ssize_t written
+        cdef int err
+        if obuflen == 0:
+            return 0
+        if obuflen > UINT32_MAX:
+            obuflen = UINT32_MAX
+        while True:
+            # The trailer is checked on the next call, so the data of a
+            # member is returned before errors in its trailer are raised.
+            if self.member_state == MEMBER_TRAILER_I:
+                self.finish_member()
+            if self.member_state == MEMBER_HEADER_I:
+                if not self.start_member():
+                    return 0
+            if self.stream.avail_in == 0:
+                self.fill_input(1)
+            avail_in_before = self.stream.avail_in
+            self.stream.next_out = obuf
+            self.stream.avail_out = <unsigned int>obuflen
+            with nogil:
+                err = isal_inflate(&self.stream)
+            if err != ISAL_DECOMP_OK:
+                check_isal_inflate_rc(err)
+            written = self.stream.next_out - obuf
+            self.pos += written
+            if self.stream.block_state == ISAL_BLOCK_FINISH:
+                self.member_state = MEMBER_TRAILER_I
+            elif written == 0 and avail_in_before == 0:
+                raise EOFError("Compressed file ended before the "
+                               "end-of-stream marker was reached")
+            if written:
+                return written
+
+
+# Gzip header flags.
+DEF FEXTRA_I = 4
+DEF FNAME_I = 8
+DEF FCOMMENT_I = 16
+DEF FHCRC_I = 2
+
+cdef Py_ssize_t find_null_byte(unsigned char *data, Py_ssize_t pos,
+                               Py_ssize_t length):
+    # Return the position after the next null byte, or -1 if there is none.
+    while pos < length:
+        if data[pos] == 0:
+            return pos + 1
+        pos += 1
+    return -1
+
+
+cdef Py_ssize_t gzip_header_end(unsigned char *data,
+                                Py_ssize_t length) except -1:
+    # Return the length of the gzip header at the start of data. Gives the
+    # same errors as igzip._gzip_header_end.
+    cdef Py_ssize_t pos = 10
+    cdef unsigned char flags
+    cdef unsigned int header_crc
+    cdef unsigned int crc
+    if length < 10:
+        raise EOFError("Compressed file ended before the end-of-stream "
+                       "marker was reached")
+    if data[0] != 0x1f or data[1] != 0x8b:
+        raise BadGzipFile("Not a gzipped file (%r)" %
+                          PyBytes_FromStringAndSize(<char *>data, 2))
+    if data[2] != 8:
+        raise BadGzipFile("Unknown compression method")
+    flags = data[3]
+    if flags & FEXTRA_I:
+        if length < pos + 2:
+            pos = -1
+        else:
+            pos += 2 + (data[pos] | data[pos + 1] << 8)
+    if pos != -1 and flags & FNAME_I:
+        pos = find_null_byte(data, pos, length)
+    if pos != -1 and flags & FCOMMENT_I:
+        pos = find_null_byte(data, pos, length)
+    if pos != -1 and flags & FHCRC_I:
+        if length < pos + 2:
+            pos = -1
+        else:
+            header_crc = data[pos] | data[pos + 1] << 8
+            # The header CRC is the lower 16 bits of the CRC-32 of the
+            # header.
+            crc = crc32_gzip_refl(0, data, pos) & 0xFFFF
+            if header_crc != crc:
+                raise BadGzipFile("Corrupted header. Checksums do not "
+                                  "match: %s != %s" % (crc, header_crc))
+            pos += 2
+    # An extra field that runs past the end is caught when inflating.
+    if pos == -1 or pos > length:
+        raise EOFError("Compressed file ended before the end-of-stream "
+                       "marker was reached")
+    return pos
+
+
+def decompress_gzip(data):
+    """
+    Decompress all members of the gzip data in *data* and return the
+    concatenated result as a bytes object. Zero padding between members is
+    skipped.
+
+    The members are inflated one after the other from the same input buffer
+    into a single output buffer. The CRC is calculated while inflating and
+    checked against the trailer of each member.
+    """
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+    try:
+        return inflate_gzip_members(<unsigned char *>buffer.buf, buffer.len)
+    finally:
+        PyBuffer_Release(buffer)
+
+
+cdef inflate_gzip_members(unsigned char *data, Py_ssize_t length):
+    cdef inflate_state stream
+    cdef PyObject *obuf = NULL
+    cdef unsigned char *next_out
+    cdef Py_ssize_t pos = 0
+    cdef Py_ssize_t ibuflen
+    cdef unsigned int crc
+    cdef unsigned int isize
+    cdef int err
+    # For a single member the size in the trailer is the exact output size.
+    # Multiple members grow the buffer.
+    cdef Py_ssize_t bufsize = gzip_trailer_size_hint(data, length)
+    if bufsize < DEF_BUF_SIZE_I:
+        bufsize = DEF_BUF_SIZE_I
+    isal_inflate_init(&stream)
+    try:
+        bufsize = arrange_output_buffer(&stream, &obuf, bufsize)
+        if bufsize == -1:
+            raise MemoryError("Unsufficient memory for buffer allocation")
+        while pos < length:
+            pos += gzip_header_end(data + pos, length - pos)
+            # Resetting clears the output position, which is kept in obuf.
+            next_out = stream.next_out
+            isal_inflate_reset(&stream)
+            stream.next_out = next_out
+            stream.hist_bits = ISAL_DEF_MAX_HIST_BITS
+            stream.crc_flag = ISAL_GZIP_NO_HDR
+            stream.crc = 0
+            stream.total_out = 0
+            stream.next_in = data + pos
+            stream.avail_in = 0
+            ibuflen = length - pos
+            while True:
+                if stream.avail_in == 0:
+                    arrange_input_buffer(&stream, &ibuflen)
+                bufsize = arrange_output_buffer(&stream, &obuf, bufsize)
+                if bufsize == -1:
+                    raise MemoryError(
+                        "Unsufficient memory for buffer allocation")
+                with nogil:
+                    err = isal_inflate(&stream)
+                if err != ISAL_DECOMP_OK:
+                    check_isal_inflate_rc(err)
+                if stream.block_state == ISAL_BLOCK_FINISH:
+                    break
+                # Output that did not fit is kept by ISA-L, so the input is
+                # only exhausted when there was room left in the output.
+                if (stream.avail_in == 0 and ibuflen == 0 and
+                        stream.avail_out != 0):
+                    raise EOFError("Compressed file ended before the "
+                                   "end-of-stream marker was reached")
+            # Whole bytes left in the bit buffer belong to the trailer.
+            pos = ((stream.next_in - data) - stream.read_in_length // 8)
+            if length - pos < 8:
+                raise EOFError("Compressed file ended before the "
+                               "end-of-stream marker was reached")
+            crc = (data[pos] | data[pos + 1] << 8 | data[pos + 2] << 16 |
+                   <unsigned int>data[pos + 3] << 24)
+            isize = (data[pos + 4] | data[pos + 5] << 8 |
+                     data[pos + 6] << 16 | <unsigned int>data[pos + 7] << 24)
+            if crc != stream.crc:
+                raise BadGzipFile("CRC check failed %s != %s" % (
+                    hex(crc), hex(stream.crc)))
+            # total_out wraps around at 4GiB like the size in the trailer.
+            if isize != stream.total_out:
+                raise BadGzipFile("Incorrect length of data produced")
+            pos += 8
+            while pos < length and data[pos] == 0:
+                pos += 1
+        return output_buffer_to_bytes(&stream, &obuf)
+    finally:
+        Py_XDECREF(obuf)
+
+
+cdef int resolve_mem_level(int mem_level, Py_ssize_t length) except -1:
+    """
+    Return the memory level to use for compressing length bytes in one go.
+    """
+    if mem_level != MEM_LEVEL_AUTO_I:
+        if not (0 <= mem_level <= MEM_LEVEL_EXTRA_LARGE_I):
+            raise ValueError("Invalid memory level")
+        return mem_level
+    # The level buffer holds the tokens for 1K (MIN), 16K (SMALL),
+    # 32K (MEDIUM), 64K (LARGE) or 128K (EXTRA_LARGE) of input per pass.
+    # Use the smallest one that fits the input, so small inputs do not pay
+    # for clearing a large buffer.
+    if length <= 1024:
+        return MEM_LEVEL_MIN_I
+    elif length <= 16 * 1024:
+        return MEM_LEVEL_SMALL_I
+    elif length <= 32 * 1024:
+        return MEM_LEVEL_MEDIUM_I
+    elif length <= 64 * 1024:
+        return MEM_LEVEL_LARGE_I
+    return MEM_LEVEL_EXTRA_LARGE_I
 
 
 cdef int mem_level_to_bufsize(int compression_level, int mem_level, unsigned int *bufsize):
     """
     Convert zlib memory levels to isal equivalents
     """
+    # Without a known input size the automatic level is the default.
+    if mem_level == MEM_LEVEL_AUTO_I:
+        mem_level = MEM_LEVEL_DEFAULT_I
     if not (0 <= mem_level <= MEM_LEVEL_EXTRA_LARGE_I):
         bufsize[0] = 0
         return -1
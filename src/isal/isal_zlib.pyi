@@ -18,6 +18,10 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+from typing import List, Optional, Union
+
+from .igzip_lib import HuffTables
+
 ISAL_BEST_SPEED: int
 ISAL_BEST_COMPRESSION: int
 ISAL_DEFAULT_COMPRESSION: int
@@ -48,14 +52,37 @@ error: IsalError
 
 def adler32(data, value: int = 1) -> int: ...
 def crc32(data, value: int = 0) -> int: ...
+def crc32_combine(crc1: int, crc2: int, length2: int) -> int: ...
+def adler32_combine(adler1: int, adler2: int, length2: int) -> int: ...
+def crc32_parallel(data, value: int = 0,
+                   threads: Optional[int] = None) -> int: ...
+def crc32_many(buffers, value: int = 0) -> List[int]: ...
 
 def compress(data, level: int = ISAL_DEFAULT_COMPRESSION,
-             wbits: int = MAX_WBITS) -> bytes: ...
+             wbits: int = MAX_WBITS,
+             hufftables: Optional[HuffTables] = None) -> bytes: ...
 def decompress(data, wbits: int = MAX_WBITS,
                bufsize: int = DEF_BUF_SIZE) -> bytes: ...
+def compress_into(data, out, level: int = ISAL_DEFAULT_COMPRESSION,
+                  wbits: int = MAX_WBITS) -> int: ...
+def decompress_into(data, out, wbits: int = MAX_WBITS) -> int: ...
+def compress_iov(fragments, level: int = ISAL_DEFAULT_COMPRESSION,
+                 wbits: int = MAX_WBITS,
+                 hufftables: Optional[HuffTables] = None,
+                 chunks: bool = False) -> Union[bytes, List[bytes]]: ...
+
+def train_dict(samples, size: int = 32768) -> bytes: ...
+
+class PreparedDict:
+    zdict: bytes
+    level: int
+
+    def __init__(self, zdict, level: int = ISAL_DEFAULT_COMPRESSION): ...
 
 class Compress:
     def compress(self, data) -> bytes: ...
+    def compress_iov(self, fragments,
+                     chunks: bool = False) -> Union[bytes, List[bytes]]: ...
     def flush(self, mode: int = Z_FINISH) -> bytes: ...
 
 class Decompress:
@@ -71,5 +98,6 @@ def compressobj(level: int = ISAL_DEFAULT_COMPRESSION,
                 wbits: int = MAX_WBITS,
                 memLevel: int = DEF_MEM_LEVEL,
                 strategy: int = Z_DEFAULT_STRATEGY,
-                zdict = None) -> Compress: ...
+                zdict = None,
+                hufftables: Optional[HuffTables] = None) -> Compress: ...
 def decompressobj(wbits: int = MAX_WBITS, zdict = None) -> Decompress: ...
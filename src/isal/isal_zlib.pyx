@@ -41,8 +41,8 @@ Implementation of the zlib module using the ISA-L libraries.
 # 4. The amount of available input bytes is set on the stream. This is either
 #    the maximum amount possible (in the case the input data is equal or larger
 #    than the maximum amount). Or the length of the (remaining) input data.
-# 5. The amount of available output bytes is set on the stream. Buffer is
-#    enlarged as needed.
+# 5. The amount of available output bytes is set on the stream. The output
+#    buffer is a bytes object that is enlarged as needed.
 # 6. inflate/deflate/flush action
 # 7. Check for errors in the action.
 # 8. Was the output buffer completely filled? (stream.avail_out == 0). If so go
@@ -52,7 +52,7 @@ Implementation of the zlib module using the ISA-L libraries.
 #    decompression: was the end of the stream reached? if not go to 4.
 # 10. In case of decompression with leftover input data. For a decompressobj
 #     this is stored in unconsumed_tail / unused_data.
-# 11. Convert output buffer to bytes object and return.
+# 11. Shrink the output bytes object to the written size and return it.
 #
 # Errors are raised in the main functions as much as possible to prevent cdef
 # functions returning PyObjects that need to be transformed in C variables.
@@ -60,9 +60,17 @@ Implementation of the zlib module using the ISA-L libraries.
 # Allowing repeated use of functions while limiting the number of python
 # interactions.
 #
+# The GIL is released around every isal_deflate and isal_inflate call (step 6)
+# so independent streams can be processed in parallel by multiple threads.
+# Compress and Decompress objects carry a lock, just like in zlibmodule.c, so
+# a single object can not be used by two threads at the same time.
+#
 ###############################################################################
 
 
+import heapq
+import multiprocessing
+import threading
 import warnings
 import zlib
 
@@ -73,27 +81,38 @@ from .igzip_lib cimport (
     IGZIP_GZIP, IGZIP_ZLIB, COMP_OK, ISAL_DECOMP_OK, ISAL_BLOCK_FINISH,
     ZSTATE_END, ISAL_DEFLATE, ISAL_GZIP, ISAL_ZLIB, ISAL_DEF_MIN_LEVEL,
     ISAL_DEF_MAX_LEVEL, isal_zstream, inflate_state, isal_deflate_init,
-    isal_deflate_set_dict, isal_deflate, isal_inflate_init,
+    isal_deflate_set_dict, isal_deflate, isal_inflate_init, isal_dict,
+    isal_deflate_process_dict, isal_deflate_reset_dict, IGZIP_HIST_SIZE,
     isal_inflate_set_dict, isal_inflate, isal_adler32)
 # Import python-isal igzip_lib cython functions
 from .igzip_lib cimport(
     check_isal_deflate_rc, check_isal_inflate_rc,
     arrange_output_buffer_with_maximum, arrange_output_buffer,
-    arrange_input_buffer, MEM_LEVEL_DEFAULT_I, MEM_LEVEL_MIN_I,
+    arrange_input_buffer, output_buffer_to_bytes, MEM_LEVEL_DEFAULT_I, MEM_LEVEL_MIN_I,
     MEM_LEVEL_SMALL_I, MEM_LEVEL_MEDIUM_I, MEM_LEVEL_LARGE_I,
-    MEM_LEVEL_EXTRA_LARGE_I, ISAL_DEFAULT_COMPRESSION_I, mem_level_to_bufsize,
-    view_bitbuffer,)
+    MEM_LEVEL_EXTRA_LARGE_I, MEM_LEVEL_AUTO_I, ISAL_DEFAULT_COMPRESSION_I,
+    mem_level_to_bufsize,
+    view_bitbuffer, acquire_lock, set_hufftables, py_ssize_t_min)
 
 # Alias igzip_lib compress and decompress functions
 from .igzip_lib cimport _compress as igzip_compress
+from .igzip_lib cimport _compress_iov as igzip_compress_iov
+from .igzip_lib cimport deflate_fragments
 from .igzip_lib cimport _decompress as igzip_decompress
+from .igzip_lib cimport _compress_into as igzip_compress_into
+from .igzip_lib cimport _decompress_into as igzip_decompress_into
 
 from . import igzip_lib
 from libc.stdint cimport UINT64_MAX, UINT32_MAX
+from libc.string cimport memset
 from cpython.mem cimport PyMem_Malloc, PyMem_Realloc, PyMem_Free
 from cpython.buffer cimport PyBUF_C_CONTIGUOUS, PyObject_GetBuffer, PyBuffer_Release
 from cpython.bytes cimport PyBytes_FromStringAndSize
 from cpython.long cimport PyLong_AsUnsignedLongMask
+from cpython.pythread cimport (
+    PyThread_type_lock, PyThread_allocate_lock, PyThread_free_lock,
+    PyThread_release_lock)
+from cpython.ref cimport PyObject, Py_XDECREF
 
 cdef extern from "<Python.h>":
     const Py_ssize_t PY_SSIZE_T_MAX
@@ -109,6 +128,20 @@ Z_DEFAULT_COMPRESSION = ISAL_DEFAULT_COMPRESSION
 # suffix should be exposed to the user.
 DEF DEF_BUF_SIZE_I = 16 * 1024
 DEF DEF_MEM_LEVEL_I = 8
+# Checksums over smaller buffers are not worth the cost of releasing the GIL.
+# Same threshold as zlibmodule.c.
+DEF NOGIL_CHECKSUM_THRESHOLD_I = 5 * 1024
+# crc32_parallel does not split buffers into chunks smaller than this. A new
+# thread is started for every chunk after the first, which takes in the order
+# of 100 microseconds. ISA-L computes the CRC-32 of 1 MiB in about that time,
+# so smaller chunks would not be faster than a single thread.
+DEF CRC32_PARALLEL_MIN_CHUNK_I = 4 * 1024 * 1024
+# Largest prime smaller than 65536, used by adler32.
+DEF ADLER32_BASE_I = 65521
+# train_dict counts substrings of this length and picks the dictionary in
+# segments of TRAIN_DICT_SEGMENT_I bytes, starting every half segment.
+DEF TRAIN_DICT_KMER_I = 8
+DEF TRAIN_DICT_SEGMENT_I = 64
 
 # Expose compile-time constants. Same names as zlib.
 DEF_BUF_SIZE = DEF_BUF_SIZE_I
@@ -153,6 +186,7 @@ def adler32(data, value = 1):
     :param value: The starting value of the checksum.
     """
     cdef unsigned long init = PyLong_AsUnsignedLongMask(value)
+    cdef unsigned int result
     cdef Py_buffer buffer_data
     cdef Py_buffer* buffer = &buffer_data
     # Cython makes sure error is handled when acquiring buffer fails.
@@ -160,7 +194,13 @@ def adler32(data, value = 1):
     try:
         if buffer.len > UINT64_MAX:
             raise ValueError("Data too big for adler32")
-        return isal_adler32(init, <unsigned char*>buffer.buf, buffer.len)
+        if buffer.len > NOGIL_CHECKSUM_THRESHOLD_I:
+            with nogil:
+                result = isal_adler32(init, <unsigned char*>buffer.buf,
+                                      buffer.len)
+        else:
+            result = isal_adler32(init, <unsigned char*>buffer.buf, buffer.len)
+        return result
     finally:
         PyBuffer_Release(buffer)
 
@@ -173,6 +213,7 @@ def crc32(data, value = 0):
     :param value: The starting value of the checksum.
     """
     cdef unsigned long init = PyLong_AsUnsignedLongMask(value)
+    cdef unsigned int result
     cdef Py_buffer buffer_data
     cdef Py_buffer* buffer = &buffer_data
     # Cython makes sure error is handled when acquiring buffer fails.
@@ -180,14 +221,227 @@ def crc32(data, value = 0):
     try:
         if buffer.len > UINT64_MAX:
             raise ValueError("Data too big for adler32")
-        return crc32_gzip_refl(init, <unsigned char*>buffer.buf, buffer.len)
+        if buffer.len > NOGIL_CHECKSUM_THRESHOLD_I:
+            with nogil:
+                result = crc32_gzip_refl(init, <unsigned char*>buffer.buf,
+                                         buffer.len)
+        else:
+            result = crc32_gzip_refl(init, <unsigned char*>buffer.buf,
+                                     buffer.len)
+        return result
+    finally:
+        PyBuffer_Release(buffer)
+
+
+def crc32_many(buffers, value = 0):
+    """
+    Computes the CRC-32 checksum of every buffer in the sequence *buffers*
+    and returns them as a list. Gives the same result as calling
+    :py:func:`crc32` for each buffer, but the checksums are calculated in one
+    loop without the GIL.
+
+    :param buffers: A sequence of binary data (bytes, bytearray, memoryview).
+    :param value: The starting value of each checksum.
+    """
+    if not isinstance(buffers, (list, tuple)):
+        buffers = list(buffers)
+    cdef unsigned int init = PyLong_AsUnsignedLongMask(value)
+    cdef Py_ssize_t count = len(buffers)
+    cdef Py_ssize_t acquired = 0
+    cdef Py_ssize_t i
+    cdef Py_buffer *views = <Py_buffer *>PyMem_Malloc(
+        count * sizeof(Py_buffer))
+    cdef unsigned int *results = <unsigned int *>PyMem_Malloc(
+        count * sizeof(unsigned int))
+    try:
+        if views == NULL or results == NULL:
+            raise MemoryError()
+        for i in range(count):
+            # Cython makes sure error is handled when acquiring buffer fails.
+            PyObject_GetBuffer(buffers[i], &views[i], PyBUF_C_CONTIGUOUS)
+            acquired = i + 1
+        with nogil:
+            for i in range(count):
+                results[i] = crc32_gzip_refl(
+                    init, <unsigned char *>views[i].buf, views[i].len)
+        return [results[i] for i in range(count)]
+    finally:
+        for i in range(acquired):
+            PyBuffer_Release(&views[i])
+        PyMem_Free(views)
+        PyMem_Free(results)
+
+
+# x^(2^n) modulo the CRC-32 polynomial for n in 0..31. Filled on import.
+cdef unsigned int crc32_x2n_table[32]
+
+
+cdef unsigned int crc32_multmodp(unsigned int a, unsigned int b) nogil:
+    # Multiply a and b modulo the reflected CRC-32 polynomial. Same algorithm
+    # as multmodp in zlib's crc32.c. a must not be zero.
+    cdef unsigned int m = 0x80000000U
+    cdef unsigned int p = 0
+    while True:
+        if a & m:
+            p ^= b
+            if (a & (m - 1)) == 0:
+                break
+        m >>= 1
+        b = (b >> 1) ^ 0xEDB88320U if b & 1 else b >> 1
+    return p
+
+
+cdef void crc32_fill_x2n_table():
+    cdef unsigned int p = 0x40000000U  # x^1
+    cdef int n
+    crc32_x2n_table[0] = p
+    for n in range(1, 32):
+        p = crc32_multmodp(p, p)
+        crc32_x2n_table[n] = p
+
+
+crc32_fill_x2n_table()
+
+
+cdef unsigned int crc32_shift(unsigned int crc,
+                              unsigned long long length) nogil:
+    # Multiply crc by x^(8 * length), which appends length zero bytes.
+    cdef unsigned int power = 0x80000000U  # x^0 == 1
+    cdef unsigned int k = 3  # x^(2^3) == x^8, one byte.
+    while length:
+        if length & 1:
+            power = crc32_multmodp(crc32_x2n_table[k & 31], power)
+        length >>= 1
+        k += 1
+    return crc32_multmodp(power, crc)
+
+
+def crc32_combine(crc1, crc2, length2):
+    """
+    Combine two CRC-32 checksums. Returns the CRC-32 of the concatenation of
+    two blocks of data, given the CRC-32 of each block and the length of the
+    second block. Takes O(log(length2)) time.
+
+    :param crc1: The CRC-32 of the first block.
+    :param crc2: The CRC-32 of the second block.
+    :param length2: The length of the second block.
+    """
+    cdef unsigned int c1 = PyLong_AsUnsignedLongMask(crc1)
+    cdef unsigned int c2 = PyLong_AsUnsignedLongMask(crc2)
+    if length2 < 0:
+        raise ValueError("length2 must not be negative")
+    cdef unsigned long long length = length2
+    return crc32_shift(c1, length) ^ c2
+
+
+def adler32_combine(adler1, adler2, length2):
+    """
+    Combine two Adler-32 checksums. Returns the Adler-32 of the concatenation
+    of two blocks of data, given the Adler-32 of each block and the length of
+    the second block.
+
+    :param adler1: The Adler-32 of the first block.
+    :param adler2: The Adler-32 of the second block.
+    :param length2: The length of the second block.
+    """
+    cdef unsigned long a1 = PyLong_AsUnsignedLongMask(adler1) & 0xFFFFFFFFUL
+    cdef unsigned long a2 = PyLong_AsUnsignedLongMask(adler2) & 0xFFFFFFFFUL
+    if length2 < 0:
+        raise ValueError("length2 must not be negative")
+    # Same algorithm as adler32_combine_ in zlib's adler32.c.
+    cdef unsigned long rem = length2 % ADLER32_BASE_I
+    cdef unsigned long sum1 = a1 & 0xFFFF
+    cdef unsigned long sum2 = (rem * sum1) % ADLER32_BASE_I
+    sum1 += (a2 & 0xFFFF) + ADLER32_BASE_I - 1
+    sum2 += (((a1 >> 16) & 0xFFFF) + ((a2 >> 16) & 0xFFFF) +
+             ADLER32_BASE_I - rem)
+    if sum1 >= ADLER32_BASE_I:
+        sum1 -= ADLER32_BASE_I
+    if sum1 >= ADLER32_BASE_I:
+        sum1 -= ADLER32_BASE_I
+    if sum2 >= (ADLER32_BASE_I << 1):
+        sum2 -= (ADLER32_BASE_I << 1)
+    if sum2 >= ADLER32_BASE_I:
+        sum2 -= ADLER32_BASE_I
+    return <unsigned int>(sum1 | (sum2 << 16))
+
+
+cdef class _Crc32Chunk:
+    # A part of a buffer whose CRC-32 is calculated on a separate thread. The
+    # buffer is owned by crc32_parallel, which outlives the threads.
+    cdef unsigned char *data
+    cdef Py_ssize_t length
+    cdef unsigned int crc
+
+    def run(self):
+        with nogil:
+            self.crc = crc32_gzip_refl(self.crc, self.data, self.length)
+
+
+def crc32_parallel(data, value = 0, threads = None):
+    """
+    Computes a CRC-32 checksum of *data* using multiple threads. The data is
+    split in one chunk per thread. The checksums of the chunks are merged
+    with :py:func:`crc32_combine`. Returns the same result as
+    :py:func:`crc32`. New threads are started on every call, so this is only
+    faster than :py:func:`crc32` for large buffers. Chunks are at least 4 MiB,
+    so buffers of up to 4 MiB are done on the calling thread alone.
+
+    :param data: Binary data (bytes, bytearray, memoryview).
+    :param value: The starting value of the checksum.
+    :param threads: The number of threads to use. Defaults to the number of
+                    CPUs.
+    """
+    if threads is None:
+        threads = multiprocessing.cpu_count()
+    if threads < 1:
+        raise ValueError("threads must be at least 1, got %s" % threads)
+    cdef unsigned int result = PyLong_AsUnsignedLongMask(value)
+    cdef Py_buffer buffer_data
+    cdef Py_buffer* buffer = &buffer_data
+    cdef Py_ssize_t chunk_size, start
+    cdef _Crc32Chunk chunk
+    cdef list started = []
+    # Cython makes sure error is handled when acquiring buffer fails.
+    PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
+    try:
+        chunk_size = (buffer.len + threads - 1) // threads
+        if chunk_size < CRC32_PARALLEL_MIN_CHUNK_I:
+            chunk_size = CRC32_PARALLEL_MIN_CHUNK_I
+        chunks = []
+        for start in range(0, buffer.len, chunk_size):
+            chunk = _Crc32Chunk()
+            chunk.data = <unsigned char *>buffer.buf + start
+            chunk.length = py_ssize_t_min(chunk_size, buffer.len - start)
+            chunk.crc = 0
+            chunks.append(chunk)
+        if not chunks:
+            return result
+        (<_Crc32Chunk>chunks[0]).crc = result
+        for chunk in chunks[1:]:
+            worker = threading.Thread(target=chunk.run)
+            worker.start()
+            started.append(worker)
+        # The first chunk is done on the calling thread.
+        (<_Crc32Chunk>chunks[0]).run()
+        for worker in started:
+            worker.join()
+        result = (<_Crc32Chunk>chunks[0]).crc
+        for chunk in chunks[1:]:
+            result = crc32_shift(result, chunk.length) ^ chunk.crc
+        return result
     finally:
+        # The threads read from the buffer, so they must be done before it
+        # is released, also when starting one of them failed.
+        for worker in started:
+            worker.join()
         PyBuffer_Release(buffer)
 
 
 def compress(data,
              int level=ISAL_DEFAULT_COMPRESSION_I,
-             int wbits = ISAL_DEF_MAX_HIST_BITS):
+             int wbits = ISAL_DEF_MAX_HIST_BITS,
+             hufftables = None):
     """
     Compresses the bytes in *data*. Returns a bytes object with the
     compressed data.
@@ -203,13 +457,42 @@ def compress(data,
                   (16 + 9 to 15) a gzip header and trailer will be used.
                   -9 to -15 will generate a raw compressed string with
                   no headers and trailers.
+    :param hufftables: Custom Huffman tables created by
+                       :py:func:`isal.igzip_lib.train_hufftables`. Only used
+                       at level 0.
     """
     cdef unsigned short hist_bits
     cdef unsigned short flag
     wbits_to_flag_and_hist_bits_deflate(wbits,
                                         &hist_bits,
                                         &flag)
-    return igzip_compress(data, level, flag, MEM_LEVEL_DEFAULT_I, hist_bits)
+    # Size the level buffer to the input.
+    return igzip_compress(data, level, flag, MEM_LEVEL_AUTO_I, hist_bits,
+                          hufftables)
+
+def compress_iov(fragments,
+                 int level=ISAL_DEFAULT_COMPRESSION_I,
+                 int wbits = ISAL_DEF_MAX_HIST_BITS,
+                 hufftables = None,
+                 bint chunks = False):
+    """
+    Compresses the concatenation of the buffers in the iterable *fragments*.
+    Returns a bytes object with the compressed data. The fragments are
+    compressed in turn without joining them first.
+
+    :param chunks: Return the compressed data as a list of bytes objects,
+                   which can be passed to ``os.writev``. The output is then
+                   never copied to grow the output buffer.
+
+    The other parameters are the same as for :py:func:`compress`.
+    """
+    cdef unsigned short hist_bits
+    cdef unsigned short flag
+    wbits_to_flag_and_hist_bits_deflate(wbits,
+                                        &hist_bits,
+                                        &flag)
+    return igzip_compress_iov(fragments, level, flag, MEM_LEVEL_AUTO_I,
+                              hist_bits, hufftables, chunks)
 
 def decompress(data,
                  int wbits=ISAL_DEF_MAX_HIST_BITS,
@@ -238,6 +521,48 @@ def decompress(data,
     return igzip_decompress(data, flag, hist_bits, bufsize)
 
 
+def compress_into(data,
+                  out,
+                  int level=ISAL_DEFAULT_COMPRESSION_I,
+                  int wbits = ISAL_DEF_MAX_HIST_BITS):
+    """
+    Compresses the bytes in *data* directly into the writable buffer *out*
+    (bytearray, memoryview, mmap etc.). Returns the number of bytes written.
+    An IsalError is raised when *out* is too small.
+
+    The *level* and *wbits* parameters are the same as for
+    :py:func:`compress`.
+    """
+    cdef unsigned short hist_bits
+    cdef unsigned short flag
+    wbits_to_flag_and_hist_bits_deflate(wbits,
+                                        &hist_bits,
+                                        &flag)
+    return igzip_compress_into(data, out, level, flag, MEM_LEVEL_AUTO_I,
+                               hist_bits)
+
+
+def decompress_into(data,
+                    out,
+                    int wbits=ISAL_DEF_MAX_HIST_BITS):
+    """
+    Decompresses the bytes in *data* directly into the writable buffer *out*
+    (bytearray, memoryview, mmap etc.). Returns the number of bytes written.
+    An IsalError is raised when *out* is too small.
+
+    The *wbits* parameter is the same as for :py:func:`decompress`.
+    """
+    cdef unsigned int hist_bits
+    cdef unsigned int flag
+    cdef bint is_gzip
+    data_is_gzip(data, &is_gzip)
+    wbits_to_flag_and_hist_bits_inflate(wbits,
+                                        &hist_bits,
+                                        &flag,
+                                        is_gzip)
+    return igzip_decompress_into(data, out, flag, hist_bits)
+
+
 def decompressobj(int wbits=ISAL_DEF_MAX_HIST_BITS,
                   zdict = None):
     """
@@ -251,7 +576,8 @@ def decompressobj(int wbits=ISAL_DEF_MAX_HIST_BITS,
                   will be expected. From +40 to +47 == 32 + (8 to 15)
                   automatically detects a gzip or zlib header.
     :zdict:       A predefined compression dictionary. Must be the same zdict
-                  as was used to compress the data.
+                  as was used to compress the data. Can also be a
+                  :py:class:`PreparedDict`.
     """
     return Decompress.__new__(Decompress, wbits, zdict)
 
@@ -261,7 +587,8 @@ def compressobj(int level=ISAL_DEFAULT_COMPRESSION_I,
                 int wbits=ISAL_DEF_MAX_HIST_BITS,
                 int memLevel=DEF_MEM_LEVEL,
                 int strategy=zlib.Z_DEFAULT_STRATEGY,
-                zdict = None):
+                zdict = None,
+                hufftables = None):
     """
     Returns a Compress object for compressing data streams.
 
@@ -283,15 +610,145 @@ def compressobj(int level=ISAL_DEFAULT_COMPRESSION_I,
     :zdict:         A predefined compression dictionary. A sequence of bytes
                     that are expected to occur frequently in the to be
                     compressed data. The most common subsequences should come
-                    at the end.
+                    at the end. A :py:class:`PreparedDict` for the same level
+                    avoids processing the dictionary for every object.
+    :param hufftables: Custom Huffman tables created by
+                       :py:func:`isal.igzip_lib.train_hufftables`. Only used
+                       at level 0.
+    """
+    return Compress.__new__(Compress, level, method, wbits, memLevel, strategy,
+                            zdict, hufftables)
+
+
+cdef class PreparedDict:
+    """
+    A compression dictionary that is processed once, so it can be used for
+    many :py:func:`compressobj` and :py:func:`decompressobj` objects. The
+    hash table of the dictionary is built when the object is created and
+    copied into every Compress object with the same level, instead of being
+    computed for each one.
+
+    :param zdict: The dictionary, as for :py:func:`compressobj`.
+    :param level: The compression level the dictionary is used with. Compress
+                  objects with another level process the dictionary again.
+    """
+    cdef isal_dict *dict_str
+    cdef readonly bytes zdict
+    cdef readonly int level
+
+    def __cinit__(self, zdict, int level=ISAL_DEFAULT_COMPRESSION_I):
+        self.zdict = bytes(zdict)
+        self.level = level
+        if len(self.zdict) == 0:
+            raise ValueError("zdict must not be empty")
+        if len(self.zdict) > UINT32_MAX:
+            raise OverflowError("zdict length does not fit in an unsigned int")
+        if not (ISAL_DEF_MIN_LEVEL <= level <= ISAL_DEF_MAX_LEVEL):
+            raise ValueError("Invalid compression level")
+        self.dict_str = <isal_dict *>PyMem_Malloc(sizeof(isal_dict))
+        if self.dict_str == NULL:
+            raise MemoryError()
+        memset(self.dict_str, 0, sizeof(isal_dict))
+        cdef isal_zstream stream
+        isal_deflate_init(&stream)
+        stream.level = level
+        err = isal_deflate_process_dict(&stream, self.dict_str, self.zdict,
+                                        len(self.zdict))
+        if err != COMP_OK:
+            check_isal_deflate_rc(err)
+
+    def __dealloc__(self):
+        PyMem_Free(self.dict_str)
+
+
+cdef Py_ssize_t segment_score(bytes segment, dict frequencies):
+    cdef Py_ssize_t i
+    cdef Py_ssize_t score = 0
+    for i in range(len(segment) - TRAIN_DICT_KMER_I + 1):
+        score += frequencies.get(segment[i:i + TRAIN_DICT_KMER_I], 0)
+    return score
+
+
+def train_dict(samples, Py_ssize_t size=32768):
+    """
+    train_dict(samples, size=32768)
+    Build a compression dictionary from a list of sample messages, for use as
+    the zdict of :py:func:`compressobj`, :py:func:`decompressobj` or
+    :py:class:`PreparedDict`.
+
+    Substrings are scored by the number of samples they occur in. The
+    segments of the samples that contain the most common substrings are
+    picked until the dictionary is full. Substrings that are already in the
+    dictionary do not count again. The most common segments are placed at the
+    end, where they are closest to the compressed data.
+
+    Samples should be many small messages that are representative of the
+    data that will be compressed. A dictionary does not help for a single
+    large input.
+
+    :param samples: A list of bytes-like objects.
+    :param size: The maximum size of the dictionary. Deflate can only refer
+                 back 32768 bytes, so larger sizes are reduced to that.
     """
-    return Compress.__new__(Compress, level, method, wbits, memLevel, strategy, zdict)
+    if size < 1:
+        raise ValueError("size must be at least 1")
+    size = py_ssize_t_min(size, IGZIP_HIST_SIZE)
+    cdef list sample_list = [memoryview(sample).tobytes()
+                             for sample in samples]
+    cdef dict frequencies = {}
+    cdef bytes sample, kmer, segment
+    cdef Py_ssize_t i, score
+    for sample in sample_list:
+        for kmer in set([sample[i:i + TRAIN_DICT_KMER_I] for i in
+                         range(len(sample) - TRAIN_DICT_KMER_I + 1)]):
+            frequencies[kmer] = frequencies.get(kmer, 0) + 1
+    # Substrings that occur in one sample only do not help other messages.
+    frequencies = dict([(kmer, count) for kmer, count in frequencies.items()
+                        if count > 1])
+
+    cdef dict segments = {}
+    for sample in sample_list:
+        for i in range(0, len(sample) - TRAIN_DICT_KMER_I + 1,
+                       TRAIN_DICT_SEGMENT_I // 2):
+            segments[sample[i:i + TRAIN_DICT_SEGMENT_I]] = None
+    cdef list heap = []
+    for segment in segments:
+        score = segment_score(segment, frequencies)
+        if score > 0:
+            heap.append((-score, segment))
+    heapq.heapify(heap)
+
+    # Pick segments greedily. The scores in the heap are upper bounds, as
+    # they only decrease when substrings are taken into the dictionary. A
+    # segment is taken when its current score is still the best.
+    cdef list chosen = []
+    cdef Py_ssize_t total = 0
+    while heap and total < size:
+        segment = heapq.heappop(heap)[1]
+        score = segment_score(segment, frequencies)
+        if score == 0:
+            continue
+        if heap and score < -heap[0][0]:
+            heapq.heappush(heap, (-score, segment))
+            continue
+        chosen.append(segment)
+        total += len(segment)
+        for i in range(len(segment) - TRAIN_DICT_KMER_I + 1):
+            frequencies.pop(segment[i:i + TRAIN_DICT_KMER_I], None)
+    if not chosen:
+        raise ValueError("The samples have no substrings in common")
+    chosen.reverse()
+    zdict = b"".join(chosen)
+    # The least common segment comes first, so it is the one that is cut.
+    return zdict[-size:]
 
 
 cdef class Compress:
     """Compress object for handling streaming compression."""
     cdef isal_zstream stream
     cdef unsigned char * level_buf
+    cdef PyThread_type_lock lock
+    cdef object hufftables
 
     def __cinit__(self,
                   int level = ISAL_DEFAULT_COMPRESSION_I,
@@ -299,7 +756,11 @@ cdef class Compress:
                   int wbits = ISAL_DEF_MAX_HIST_BITS,
                   int memLevel = DEF_MEM_LEVEL,
                   int strategy = Z_DEFAULT_STRATEGY,
-                  zdict = None):
+                  zdict = None,
+                  hufftables = None):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
         if strategy != Z_DEFAULT_STRATEGY:
             warnings.warn("Only one strategy is supported when using "
                           "isal_zlib. Using the default strategy.")
@@ -309,7 +770,26 @@ cdef class Compress:
                                             &self.stream.hist_bits,
                                             &self.stream.gzip_flag)
 
+        self.stream.level = level
+        zlib_mem_level_to_isal_bufsize(level, memLevel, &self.stream.level_buf_size)
+        self.level_buf = <unsigned char *>PyMem_Malloc(self.stream.level_buf_size * sizeof(char))
+        self.stream.level_buf = self.level_buf
+        set_hufftables(&self.stream, hufftables)
+        # Keep the tables alive while the stream uses them.
+        self.hufftables = hufftables
+
         cdef Py_ssize_t zdict_length
+        cdef PreparedDict prepared
+        if isinstance(zdict, PreparedDict):
+            prepared = <PreparedDict>zdict
+            if prepared.level == level:
+                # The hash table of the dictionary is copied instead of
+                # computed again.
+                err = isal_deflate_reset_dict(&self.stream, prepared.dict_str)
+                if err != COMP_OK:
+                    check_isal_deflate_rc(err)
+                return
+            zdict = prepared.zdict
         if zdict:
             zdict_length = len(zdict)
             if zdict_length > UINT32_MAX:
@@ -317,14 +797,12 @@ cdef class Compress:
             err = isal_deflate_set_dict(&self.stream, zdict, zdict_length)
             if err != COMP_OK:
                 check_isal_deflate_rc(err)
-        self.stream.level = level
-        zlib_mem_level_to_isal_bufsize(level, memLevel, &self.stream.level_buf_size)
-        self.level_buf = <unsigned char *>PyMem_Malloc(self.stream.level_buf_size * sizeof(char))
-        self.stream.level_buf = self.level_buf
 
     def __dealloc__(self):
         if self.level_buf is not NULL:
             PyMem_Free(self.level_buf)
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
 
     def compress(self, data):
         """
@@ -334,7 +812,7 @@ cdef class Compress:
         Some input may be kept in internal buffers for later processing.
         """
         # Initialise output buffer
-        cdef unsigned char * obuf = NULL
+        cdef PyObject * obuf = NULL
         cdef Py_ssize_t obuflen = DEF_BUF_SIZE_I
 
         # initialise input
@@ -343,18 +821,20 @@ cdef class Compress:
         # Cython makes sure error is handled when acquiring buffer fails.
         PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
         cdef Py_ssize_t ibuflen = buffer.len
-        self.stream.next_in = <unsigned char*>buffer.buf
 
         # initialise helper variables
         cdef int err
+        acquire_lock(self.lock)
         try:
+            self.stream.next_in = <unsigned char*>buffer.buf
             while True:
                 arrange_input_buffer(&self.stream, &ibuflen)
                 while True:
                     obuflen = arrange_output_buffer(&self.stream, &obuf, obuflen)
                     if obuflen== -1:
                         raise MemoryError("Unsufficient memory for buffer allocation")
-                    err = isal_deflate(&self.stream)
+                    with nogil:
+                        err = isal_deflate(&self.stream)
                     if err != COMP_OK:
                         check_isal_deflate_rc(err)
                     if self.stream.avail_out != 0:
@@ -363,10 +843,25 @@ cdef class Compress:
                     raise AssertionError("Input stream should be empty")
                 if ibuflen == 0:
                     break
-            return PyBytes_FromStringAndSize(<char*>obuf, self.stream.next_out - obuf)
+            return output_buffer_to_bytes(&self.stream, &obuf)
         finally:
             PyBuffer_Release(buffer)
-            PyMem_Free(obuf)
+            PyThread_release_lock(self.lock)
+            Py_XDECREF(obuf)
+
+    def compress_iov(self, fragments, bint chunks=False):
+        """
+        Compress the buffers in the iterable *fragments* in turn, as if
+        :py:meth:`compress` was called with their concatenation. Returns a
+        bytes object with at least part of the compressed data, or a list of
+        bytes objects for ``os.writev`` when *chunks* is true.
+        """
+        acquire_lock(self.lock)
+        try:
+            return deflate_fragments(&self.stream, fragments, False,
+                                     [] if chunks else None)
+        finally:
+            PyThread_release_lock(self.lock)
 
     def flush(self, mode=zlib.Z_FINISH):
         """
@@ -382,34 +877,38 @@ cdef class Compress:
         if mode == zlib.Z_NO_FLUSH:
             # Flushing with no_flush does nothing.
             return b""
-        elif mode == zlib.Z_FINISH:
-            self.stream.flush = FULL_FLUSH
-            self.stream.end_of_stream = 1
-        elif mode == zlib.Z_FULL_FLUSH:
-            self.stream.flush = FULL_FLUSH
-        elif mode == zlib.Z_SYNC_FLUSH:
-            self.stream.flush=SYNC_FLUSH
-        else:
+        elif mode not in (zlib.Z_FINISH, zlib.Z_FULL_FLUSH, zlib.Z_SYNC_FLUSH):
             raise IsalError("Unsupported flush mode")
 
         cdef Py_ssize_t length = DEF_BUF_SIZE_I
-        cdef unsigned char * obuf = NULL
+        cdef PyObject * obuf = NULL
+        cdef int err
 
+        acquire_lock(self.lock)
         try:
+            if mode == zlib.Z_FINISH:
+                self.stream.flush = FULL_FLUSH
+                self.stream.end_of_stream = 1
+            elif mode == zlib.Z_FULL_FLUSH:
+                self.stream.flush = FULL_FLUSH
+            else:
+                self.stream.flush = SYNC_FLUSH
             while True:
                 length = arrange_output_buffer(&self.stream, &obuf, length)
                 if length == -1:
                     raise MemoryError("Unsufficient memory for buffer allocation")
-                err = isal_deflate(&self.stream)
+                with nogil:
+                    err = isal_deflate(&self.stream)
                 if err != COMP_OK:
                     check_isal_deflate_rc(err)
                 if self.stream.avail_out != 0:
                     break
             if self.stream.avail_in != 0:
                 raise AssertionError("There should be no available input after flushing.")
-            return PyBytes_FromStringAndSize(<char*>obuf, self.stream.next_out - obuf)
+            return output_buffer_to_bytes(&self.stream, &obuf)
         finally:
-            PyMem_Free(obuf)
+            PyThread_release_lock(self.lock)
+            Py_XDECREF(obuf)
 
 cdef class Decompress:
     """Decompress object for handling streaming decompression."""
@@ -419,8 +918,12 @@ cdef class Decompress:
     cdef inflate_state stream
     cdef bint method_set
     cdef bint is_gzip
+    cdef PyThread_type_lock lock
 
     def __cinit__(self, int wbits=ISAL_DEF_MAX_HIST_BITS, zdict = None):
+        self.lock = PyThread_allocate_lock()
+        if self.lock == NULL:
+            raise MemoryError("Unable to allocate lock")
         isal_inflate_init(&self.stream)
 
         wbits_to_flag_and_hist_bits_inflate(wbits,
@@ -432,6 +935,9 @@ cdef class Decompress:
             self.method_set = 1
 
         cdef Py_ssize_t zdict_length
+        if isinstance(zdict, PreparedDict):
+            # Inflate only copies the dictionary into its history.
+            zdict = (<PreparedDict>zdict).zdict
         if zdict:
             zdict_length = len(zdict)
             if zdict_length > UINT32_MAX:
@@ -443,6 +949,10 @@ cdef class Decompress:
         self.unconsumed_tail = b""
         self.eof = False
 
+    def __dealloc__(self):
+        if self.lock != NULL:
+            PyThread_free_lock(self.lock)
+
     def _view_bitbuffer(self):
         """Shows the 64-bitbuffer of the internal inflate_state. It contains
         a maximum of 8 bytes. This data is already read-in so is not part
@@ -491,30 +1001,30 @@ cdef class Decompress:
         else:
             hard_limit = max_length
 
-        if not self.method_set:
-            # Try to detect method from the first two bytes of the data.
-            data_is_gzip(data, &self.is_gzip)
-            self.stream.crc_flag = ISAL_GZIP if self.is_gzip else ISAL_ZLIB
-            self.method_set = 1
-
         # initialise input
         cdef Py_buffer buffer_data
         cdef Py_buffer* buffer = &buffer_data
         # Cython makes sure error is handled when acquiring buffer fails.
         PyObject_GetBuffer(data, buffer, PyBUF_C_CONTIGUOUS)
         cdef Py_ssize_t ibuflen = buffer.len
-        self.stream.next_in = <unsigned char*>buffer.buf
 
         cdef int err
         cdef bint max_length_reached = False
         
         # Initialise output buffer
-        cdef unsigned char *obuf = NULL
+        cdef PyObject *obuf = NULL
         cdef Py_ssize_t obuflen = DEF_BUF_SIZE_I
         if obuflen > hard_limit:
             obuflen = hard_limit
 
+        acquire_lock(self.lock)
         try:
+            if not self.method_set:
+                # Try to detect method from the first two bytes of the data.
+                data_is_gzip(data, &self.is_gzip)
+                self.stream.crc_flag = ISAL_GZIP if self.is_gzip else ISAL_ZLIB
+                self.method_set = 1
+            self.stream.next_in = <unsigned char*>buffer.buf
             while True:
                 arrange_input_buffer(&self.stream, &ibuflen)
                 while True:
@@ -525,7 +1035,8 @@ cdef class Decompress:
                     elif obuflen == -2:
                         max_length_reached = True
                         break
-                    err = isal_inflate(&self.stream)
+                    with nogil:
+                        err = isal_inflate(&self.stream)
                     if err != ISAL_DECOMP_OK:
                         check_isal_inflate_rc(err)
                     if self.stream.block_state == ISAL_BLOCK_FINISH or self.stream.avail_out != 0:
@@ -533,10 +1044,11 @@ cdef class Decompress:
                 if self.stream.block_state == ISAL_BLOCK_FINISH or ibuflen ==0 or max_length_reached:
                     break
             self.save_unconsumed_input(buffer)
-            return PyBytes_FromStringAndSize(<char*>obuf, self.stream.next_out - obuf)
+            return output_buffer_to_bytes(&self.stream, &obuf)
         finally:
             PyBuffer_Release(buffer)
-            PyMem_Free(obuf)
+            PyThread_release_lock(self.lock)
+            Py_XDECREF(obuf)
 
     def flush(self, Py_ssize_t length = DEF_BUF_SIZE):
         """
@@ -553,21 +1065,23 @@ cdef class Decompress:
         # Cython makes sure error is handled when acquiring buffer fails.
         PyObject_GetBuffer(self.unconsumed_tail, buffer, PyBUF_C_CONTIGUOUS)
         cdef Py_ssize_t ibuflen = buffer.len
-        self.stream.next_in = <unsigned char*>buffer.buf
 
-        cdef unsigned int obuflen = length
-        cdef unsigned char * obuf = NULL
+        cdef Py_ssize_t obuflen = length
+        cdef PyObject * obuf = NULL
 
         cdef int err
 
+        acquire_lock(self.lock)
         try:
+            self.stream.next_in = <unsigned char*>buffer.buf
             while True:
                 arrange_input_buffer(&self.stream, &ibuflen)
                 while True:
                     obuflen = arrange_output_buffer(&self.stream, &obuf, obuflen)
                     if obuflen == -1:
                         raise MemoryError("Unsufficient memory for buffer allocation")
-                    err = isal_inflate(&self.stream)
+                    with nogil:
+                        err = isal_inflate(&self.stream)
                     if err != ISAL_DECOMP_OK:
                         check_isal_inflate_rc(err)
                     if self.stream.avail_out != 0 or self.stream.block_state == ISAL_BLOCK_FINISH:
@@ -575,10 +1089,11 @@ cdef class Decompress:
                 if self.stream.block_state == ISAL_BLOCK_FINISH or ibuflen == 0:
                     break
             self.save_unconsumed_input(buffer)
-            return PyBytes_FromStringAndSize(<char*>obuf, self.stream.next_out - obuf)
+            return output_buffer_to_bytes(&self.stream, &obuf)
         finally:
             PyBuffer_Release(buffer)
-            PyMem_Free(obuf)
+            PyThread_release_lock(self.lock)
+            Py_XDECREF(obuf)
 
 cdef data_is_gzip(object data, bint *is_gzip):
     cdef Py_buffer buffer_data
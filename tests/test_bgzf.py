@@ -0,0 +1,203 @@
+# Copyright (c) 2020 Leiden University Medical Center
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import gzip
+import io
+import os
+import struct
+try:
+    from pathlib import Path
+except ImportError:
+    from pathlib2 import Path
+
+from isal import bgzf
+from isal.igzip import BadGzipFile
+
+import pytest
+
+DATA = gzip.decompress(
+    (Path(__file__).parent / "data" / "test.fastq.gz").read_bytes())
+
+
+def bgzf_blocks(compressed):
+    """Split a BGZF file into its blocks."""
+    blocks = []
+    pos = 0
+    while pos < len(compressed):
+        assert compressed[pos + 12:pos + 16] == b"BC\x02\x00"
+        block_size, = struct.unpack_from("<H", compressed, pos + 16)
+        blocks.append(compressed[pos:pos + block_size + 1])
+        pos += block_size + 1
+    return blocks
+
+
+@pytest.mark.parametrize("threads", [1, 4])
+def test_bgzf_write_read(threads):
+    buffer = io.BytesIO()
+    with bgzf.BgzfWriter(fileobj=buffer, threads=threads) as writer:
+        writer.write(DATA)
+    compressed = buffer.getvalue()
+    assert compressed.endswith(bgzf.BGZF_EOF)
+    blocks = bgzf_blocks(compressed)
+    assert all(len(block) <= 65536 for block in blocks)
+    assert len(blocks) == len(DATA) // bgzf.BGZF_BLOCK_SIZE + 2
+    # BGZF files are valid multi-member gzip files.
+    assert gzip.decompress(compressed) == DATA
+    buffer.seek(0)
+    with bgzf.BgzfReader(fileobj=buffer, threads=threads) as reader:
+        assert reader.read() == DATA
+
+
+def test_bgzf_incompressible_data():
+    data = os.urandom(3 * bgzf.BGZF_BLOCK_SIZE)
+    buffer = io.BytesIO()
+    with bgzf.BgzfWriter(fileobj=buffer) as writer:
+        writer.write(data)
+    assert all(len(block) <= 65536
+               for block in bgzf_blocks(buffer.getvalue()))
+    assert gzip.decompress(buffer.getvalue()) == data
+
+
+@pytest.mark.parametrize("threads", [1, 3])
+def test_bgzf_virtual_offsets(threads, tmp_path):
+    path = tmp_path / "test.fastq.bgz"
+    lines = DATA.splitlines(keepends=True)[:20000]
+    offsets = []
+    with bgzf.open(path, "wb", threads=threads) as writer:
+        for line in lines:
+            offsets.append(writer.tell())
+            writer.write(line)
+    with bgzf.open(path, "rb", threads=threads) as reader:
+        for i in (1000, 5, 19999, 0, 12345, 12346):
+            reader.seek(offsets[i])
+            assert reader.readline() == lines[i]
+        position = reader.tell()
+        line = reader.readline()
+        reader.seek(position)
+        assert reader.readline() == line
+
+
+def test_bgzf_gzi(tmp_path):
+    path = tmp_path / "test.fastq.bgz"
+    gzi_path = tmp_path / "test.fastq.bgz.gzi"
+    with bgzf.open(path, "wb", threads=2) as writer:
+        writer.write(DATA)
+    writer.write_gzi(gzi_path)
+    entries = bgzf.read_gzi(gzi_path)
+    assert entries[0] == (0, 0)
+    assert entries[1] == (len(bgzf_blocks(path.read_bytes())[0]),
+                          bgzf.BGZF_BLOCK_SIZE)
+    with bgzf.BgzfReader(path, gzi=gzi_path) as reader:
+        for offset in (len(DATA) - 10, 0, 100000, bgzf.BGZF_BLOCK_SIZE,
+                       bgzf.BGZF_BLOCK_SIZE * 3 - 1):
+            reader.seek_uncompressed(offset)
+            assert reader.read(1000) == DATA[offset:offset + 1000]
+
+
+def test_bgzf_text_mode(tmp_path):
+    path = tmp_path / "test.txt.bgz"
+    with bgzf.open(path, "wt") as writer:
+        writer.write("hello\nworld\n")
+    with bgzf.open(path, "rt") as reader:
+        assert reader.readlines() == ["hello\n", "world\n"]
+
+
+def test_bgzf_read_not_bgzf():
+    with bgzf.BgzfReader(fileobj=io.BytesIO(gzip.compress(DATA))) as reader:
+        with pytest.raises(BadGzipFile):
+            reader.read()
+
+
+def test_bgzf_read_truncated():
+    buffer = io.BytesIO()
+    with bgzf.BgzfWriter(fileobj=buffer) as writer:
+        writer.write(DATA[:200000])
+    compressed = buffer.getvalue()
+    truncated = io.BytesIO(compressed[:len(compressed) // 2])
+    with bgzf.BgzfReader(fileobj=truncated) as reader:
+        with pytest.raises(EOFError):
+            reader.read()
+
+
+def test_bgzf_read_wrong_crc():
+    buffer = io.BytesIO()
+    with bgzf.BgzfWriter(fileobj=buffer) as writer:
+        writer.write(DATA[:1000])
+    compressed = bytearray(buffer.getvalue())
+    block_end = len(bgzf_blocks(bytes(compressed))[0])
+    # Corrupt the CRC in the trailer of the first block.
+    compressed[block_end - 8] ^= 0xFF
+    with bgzf.BgzfReader(fileobj=io.BytesIO(bytes(compressed))) as reader:
+        with pytest.raises(BadGzipFile):
+            reader.read()
+
+
+class PipeReader(io.RawIOBase):
+    """A raw file object without seek and tell, like a pipe."""
+    def __init__(self, data):
+        self._data = io.BytesIO(data)
+
+    def readable(self):
+        return True
+
+    def readinto(self, b):
+        return self._data.readinto(b)
+
+
+def test_bgzf_reader_seekable():
+    with bgzf.BgzfReader(fileobj=PipeReader(bgzf.BGZF_EOF)) as reader:
+        assert not reader.seekable()
+    with bgzf.BgzfReader(fileobj=io.BytesIO(bgzf.BGZF_EOF)) as reader:
+        assert reader.seekable()
+
+
+@pytest.mark.parametrize("threads", [1, 3])
+def test_bgzf_read_unseekable(threads):
+    buffer = io.BytesIO()
+    with bgzf.BgzfWriter(fileobj=buffer) as writer:
+        writer.write(DATA[:200000])
+    pipe = io.BufferedReader(PipeReader(buffer.getvalue()))
+    with bgzf.BgzfReader(fileobj=pipe, threads=threads) as reader:
+        assert reader.read(100) == DATA[:100]
+        assert reader.tell() == bgzf.make_virtual_offset(0, 100)
+        assert reader.read() == DATA[100:200000]
+        with pytest.raises(io.UnsupportedOperation):
+            reader.seek(0)
+        with pytest.raises(io.UnsupportedOperation):
+            reader.seek_uncompressed(0)
+
+
+def test_bgzf_append_gzi(tmp_path):
+    path = tmp_path / "test.txt.bgz"
+    with bgzf.open(path, "wb") as writer:
+        writer.write(b"hello\n")
+    with bgzf.open(path, "ab") as writer:
+        writer.write(b"world\n")
+        with pytest.raises(ValueError):
+            writer.write_gzi(tmp_path / "test.txt.bgz.gzi")
+    with bgzf.open(path, "rb") as reader:
+        assert reader.read() == b"hello\nworld\n"
+
+
+def test_virtual_offsets():
+    assert bgzf.make_virtual_offset(100000, 5) == (100000 << 16) | 5
+    assert bgzf.split_virtual_offset((100000 << 16) | 5) == (100000, 5)
+    with pytest.raises(ValueError):
+        bgzf.make_virtual_offset(0, 65536)
@@ -61,6 +61,45 @@ def test_adler32(data_size, value):
     assert zlib.adler32(data, value) == isal_zlib.adler32(data, value)
 
 
+@pytest.mark.parametrize("split", [0, 1, 4096, 65521, 100000])
+def test_crc32_combine(split):
+    data = DATA[:100000]
+    first, second = data[:split], data[split:]
+    assert isal_zlib.crc32_combine(
+        zlib.crc32(first), zlib.crc32(second), len(second)
+    ) == zlib.crc32(data)
+
+
+@pytest.mark.parametrize("split", [0, 1, 4096, 65521, 100000])
+def test_adler32_combine(split):
+    data = DATA[:100000]
+    first, second = data[:split], data[split:]
+    assert isal_zlib.adler32_combine(
+        zlib.adler32(first), zlib.adler32(second), len(second)
+    ) == zlib.adler32(data)
+
+
+@pytest.mark.parametrize(["threads", "value"],
+                         itertools.product([1, 2, 3, 8], SEEDS[:6]))
+def test_crc32_parallel(threads, value):
+    # Large enough to be split into multiple chunks.
+    data = DATA * 4
+    assert (isal_zlib.crc32_parallel(data, value, threads) ==
+            zlib.crc32(data, value))
+
+
+def test_crc32_parallel_empty():
+    assert isal_zlib.crc32_parallel(b"", 42, 4) == 42
+
+
+@pytest.mark.parametrize("value", SEEDS[:6])
+def test_crc32_many(value):
+    buffers = [DATA[i:i * 2] for i in range(0, 20000, 997)]
+    assert isal_zlib.crc32_many(buffers, value) == [
+        zlib.crc32(buffer, value) for buffer in buffers]
+    assert isal_zlib.crc32_many([], value) == []
+
+
 @pytest.mark.parametrize(["data_size", "level"],
                          itertools.product(DATA_SIZES, range(4)))
 def test_compress(data_size, level):
@@ -69,6 +108,48 @@ def test_compress(data_size, level):
     assert zlib.decompress(compressed) == data
 
 
+@pytest.mark.parametrize(["data_size", "wbits"],
+                         itertools.product(DATA_SIZES, WBITS_RANGE))
+def test_compress_into(data_size, wbits):
+    data = DATA[:data_size]
+    out = bytearray(data_size + 1024)
+    written = isal_zlib.compress_into(data, out, wbits=wbits)
+    assert zlib.decompress(out[:written], wbits) == data
+
+
+@pytest.mark.parametrize(["data_size", "wbits"],
+                         itertools.product(DATA_SIZES, [-15, 15, 31]))
+def test_compress_iov(data_size, wbits):
+    data = DATA[:data_size]
+    fragments = [data[i:i + 1000] for i in range(0, data_size, 1000)]
+    compressed = isal_zlib.compress_iov(fragments, wbits=wbits)
+    assert zlib.decompress(compressed, wbits) == data
+    compressobj = isal_zlib.compressobj(wbits=wbits)
+    compressed = (compressobj.compress_iov(fragments[:3]) +
+                  compressobj.compress(data[3000:5000]) +
+                  compressobj.compress_iov(iter(fragments[5:])) +
+                  compressobj.flush())
+    assert zlib.decompress(compressed, wbits) == data
+    chunks = isal_zlib.compress_iov(fragments, wbits=wbits, chunks=True)
+    assert zlib.decompress(b"".join(chunks), wbits) == data
+    compressobj = isal_zlib.compressobj(wbits=wbits)
+    chunks = compressobj.compress_iov(fragments, chunks=True)
+    assert isinstance(chunks, list)
+    assert zlib.decompress(b"".join(chunks) + compressobj.flush(),
+                           wbits) == data
+
+
+@pytest.mark.parametrize(["data_size", "wbits"],
+                         itertools.product(DATA_SIZES, WBITS_RANGE))
+def test_decompress_into(data_size, wbits):
+    data = DATA[:data_size]
+    compressobj = zlib.compressobj(wbits=wbits)
+    compressed = compressobj.compress(data) + compressobj.flush()
+    out = bytearray(data_size)
+    assert isal_zlib.decompress_into(compressed, out, wbits) == data_size
+    assert out == data
+
+
 @pytest.mark.parametrize(["data_size", "level"],
                          itertools.product(DATA_SIZES, range(10)))
 def test_decompress_zlib(data_size, level):
@@ -139,6 +220,53 @@ def test_decompressobj_unconsumed_tail():
     assert len(output) == 2048
 
 
+@pytest.mark.parametrize(["level", "dict_level", "wbits"],
+                         itertools.product(range(4), [0, 2], [-15, 15]))
+def test_compressobj_prepared_dict(level, dict_level, wbits):
+    zdict = DATA[:32 * 1024]
+    data = DATA[32 * 1024:33 * 1024]
+    prepared = isal_zlib.PreparedDict(zdict, dict_level)
+    assert prepared.zdict == zdict
+    assert prepared.level == dict_level
+    compressobj = isal_zlib.compressobj(level=level, wbits=wbits,
+                                        zdict=prepared)
+    compressed = compressobj.compress(data) + compressobj.flush()
+    compressobj = isal_zlib.compressobj(level=level, wbits=wbits,
+                                        zdict=zdict)
+    assert compressed == compressobj.compress(data) + compressobj.flush()
+    decompressobj = zlib.decompressobj(wbits=wbits, zdict=zdict)
+    assert decompressobj.decompress(compressed) == data
+    decompressobj = isal_zlib.decompressobj(wbits=wbits, zdict=prepared)
+    assert decompressobj.decompress(compressed) == data
+
+
+def test_train_dict():
+    # Use FASTQ records as small messages that share a lot of content.
+    records = [b"@" + record for record in DATA[1:256 * 1024].split(b"\n@")]
+    samples, messages = records[:500], records[500:1000]
+    zdict = isal_zlib.train_dict(samples, 4096)
+    assert 0 < len(zdict) <= 4096
+    plain_size = dict_size = 0
+    for message in messages:
+        compressobj = isal_zlib.compressobj(wbits=-15)
+        plain_size += len(compressobj.compress(message) + compressobj.flush())
+        compressobj = isal_zlib.compressobj(wbits=-15, zdict=zdict)
+        compressed = compressobj.compress(message) + compressobj.flush()
+        dict_size += len(compressed)
+        decompressobj = zlib.decompressobj(wbits=-15, zdict=zdict)
+        assert decompressobj.decompress(compressed) == message
+    assert dict_size < plain_size
+    # Deflate can not use more than 32K of history.
+    assert len(isal_zlib.train_dict(samples, 1024 * 1024)) <= 32 * 1024
+
+
+def test_train_dict_invalid():
+    with pytest.raises(ValueError):
+        isal_zlib.train_dict([b"abcdefghijkl", b"abcdefghijkl"], 0)
+    with pytest.raises(ValueError):
+        isal_zlib.train_dict([b"abcdefghijkl", b"mnopqrstuvwx"])
+
+
 @pytest.mark.parametrize(["data_size", "level"],
                          itertools.product(DATA_SIZES, range(4)))
 def test_igzip_compress(data_size, level):
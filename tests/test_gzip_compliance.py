@@ -634,8 +634,8 @@ class TestGzip(BaseTest):
         # See issue #20875
         with igzip.open(self.filename, "wb") as f:
             f.write(data1)
-        with igzip.open(self.filename, "rb") as f:
-            f._buffer.raw._fp.prepend()
+        with open(self.filename, "rb") as f:
+            igzip._IGzipReader(f)._fp.prepend()
 
 
 class TestOpen(BaseTest):
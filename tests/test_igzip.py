@@ -36,7 +36,7 @@ try:
 except ImportError:
     from pathlib2 import Path
 
-from isal import igzip, isal_zlib
+from isal import igzip, igzip_lib, isal_zlib
 
 import pytest
 
@@ -383,3 +383,287 @@ def test_concatenated_gzip():
     with igzip.open(concat, "rb") as igzip_h:
         result = igzip_h.read()
     assert data == result
+
+
+def test_readinto_concatenated_gzip():
+    concat = Path(__file__).parent / "data" / "concatenated.fastq.gz"
+    data = gzip.decompress(concat.read_bytes())
+    result = bytearray()
+    buffer = bytearray(10000)
+    with igzip.open(concat, "rb") as igzip_h:
+        while True:
+            written = igzip_h.readinto(buffer)
+            if not written:
+                break
+            result += buffer[:written]
+    assert data == result
+
+
+@pytest.mark.parametrize("threads", [1, 2, 4])
+def test_compress_threads(threads):
+    data = gzip.decompress(
+        (Path(__file__).parent / "data" / "test.fastq.gz").read_bytes())
+    compressed = igzip.compress(data, threads=threads)
+    assert gzip.decompress(compressed) == data
+
+
+@pytest.mark.parametrize("block_size", [1, 1000, 32 * 1024, 100000])
+def test_parallel_igzip_file(block_size):
+    data = gzip.decompress(
+        (Path(__file__).parent / "data" / "test.fastq.gz").read_bytes())
+    data = data[:500000]
+    buffer = io.BytesIO()
+    with igzip.ParallelIGzipFile(fileobj=buffer, mode="wb", threads=3,
+                                 block_size=block_size) as gzip_file:
+        for i in range(0, len(data), 3331):
+            gzip_file.write(data[i:i + 3331])
+        gzip_file.flush()
+    assert gzip.decompress(buffer.getvalue()) == data
+
+
+def test_open_threads(tmp_path):
+    data = b"AAAACCCCGGGGTTTT" * 100000
+    path = tmp_path / "test.gz"
+    with igzip.open(path, "wb", threads=2) as gzip_file:
+        assert isinstance(gzip_file, igzip.ParallelIGzipFile)
+        gzip_file.write(data)
+    assert gzip.decompress(path.read_bytes()) == data
+    with igzip.open(path, "rb", threads=2) as gzip_file:
+        assert gzip_file.read() == data
+
+
+@pytest.mark.parametrize("threads", [2, 3, 8])
+def test_parallel_igzip_file_read_members(threads, monkeypatch):
+    # Use small batches so the file is read in multiple batches.
+    monkeypatch.setattr(igzip, "PARALLEL_BLOCK_SIZE", 10000)
+    data = gzip.decompress(
+        (Path(__file__).parent / "data" / "test.fastq.gz").read_bytes())
+    data = data[:500000]
+    members = [gzip.compress(data[i:i + 7777])
+               for i in range(0, len(data), 7777)]
+    compressed = b"".join(members)
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(compressed), mode="rb",
+                                 threads=threads) as gzip_file:
+        assert gzip_file.read(1000) == data[:1000]
+        assert gzip_file.tell() == 1000
+        assert gzip_file.read() == data[1000:]
+        gzip_file.seek(0)
+        assert gzip_file.read(5000) == data[:5000]
+
+
+def test_parallel_igzip_file_read_single_member():
+    data = b"AAAACCCCGGGGTTTT" * 100000
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(gzip.compress(data)),
+                                 mode="rb", threads=4) as gzip_file:
+        assert gzip_file.read() == data
+
+
+def test_parallel_igzip_file_read_false_member_start(monkeypatch):
+    monkeypatch.setattr(igzip, "PARALLEL_BLOCK_SIZE", 10000)
+    # Stored blocks contain the data as is, so the gzip magic in the data
+    # shows up as possible member starts in the compressed file.
+    data = b"\x1f\x8b\x08\x00" * 50000
+    compressed = gzip.compress(data, 0) + gzip.compress(data, 0)
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(compressed), mode="rb",
+                                 threads=4) as gzip_file:
+        assert gzip_file.read() == data + data
+
+
+def test_parallel_igzip_file_read_resumes_after_sequential(monkeypatch):
+    monkeypatch.setattr(igzip, "PARALLEL_BLOCK_SIZE", 1000)
+    calls = []
+
+    def counting_decompress(data):
+        calls.append(len(data))
+        return gzip.decompress(data)
+
+    monkeypatch.setattr(igzip, "decompress", counting_decompress)
+    # The first member spans more than a batch and has no possible member
+    # starts in it, so it is decompressed sequentially.
+    first = bytes(range(32, 127)) * 100
+    members = [b"member %d" % i for i in range(50)]
+    compressed = gzip.compress(first, 0) + b"".join(
+        gzip.compress(member) for member in members)
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(compressed), mode="rb",
+                                 threads=2) as gzip_file:
+        assert gzip_file.read() == first + b"".join(members)
+    assert calls
+
+
+@pytest.mark.parametrize("members", [1, 100])
+def test_parallel_igzip_file_read_mtime(members):
+    compressed = b"".join(gzip.compress(bytes([i]) * 10000, mtime=1)
+                          for i in range(members))
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(compressed), mode="rb",
+                                 threads=4) as gzip_file:
+        assert gzip_file.mtime is None
+        gzip_file.read()
+        assert gzip_file.mtime == 1
+
+
+def test_parallel_igzip_file_read_truncated():
+    compressed = b"".join(gzip.compress(bytes([i]) * 10000)
+                          for i in range(100))
+    with igzip.ParallelIGzipFile(fileobj=io.BytesIO(compressed[:-5]),
+                                 mode="rb", threads=4) as gzip_file:
+        with pytest.raises(EOFError):
+            gzip_file.read()
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_compress_hufftables(threads):
+    data = gzip.decompress(
+        (Path(__file__).parent / "data" / "test.fastq.gz").read_bytes())
+    tables = igzip_lib.train_hufftables(data[:100000])
+    compressed = igzip.compress(data, 0, threads=threads, hufftables=tables)
+    assert gzip.decompress(compressed) == data
+    buffer = io.BytesIO()
+    with igzip.IGzipFile(fileobj=buffer, mode="wb", compresslevel=0,
+                         hufftables=tables) as gzip_file:
+        gzip_file.write(data)
+    assert gzip.decompress(buffer.getvalue()) == data
+
+
+@pytest.mark.parametrize("filename",
+                         ["test.fastq.gz", "concatenated.fastq.gz"])
+def test_build_index_seek(filename, tmp_path):
+    path = Path(__file__).parent / "data" / filename
+    data = gzip.decompress(path.read_bytes())
+    index = igzip.build_index(path, spacing=100000)
+    assert len(index) > 0
+    index_path = tmp_path / "index.gzi"
+    index.save(index_path)
+    for index_arg in (index, index_path):
+        with igzip.open(path, "rb", index=index_arg) as gzip_file:
+            for offset in (len(data) - 1000, 150000, 0, 250001,
+                           len(data) // 2, 99999):
+                gzip_file.seek(offset)
+                assert gzip_file.read(5000) == data[offset:offset + 5000]
+            gzip_file.seek(-1000, io.SEEK_CUR)
+            assert gzip_file.read() == data[offset + 4000:]
+
+
+@pytest.mark.parametrize("length", [10, 20, 40, -10])
+def test_gzip_index_load_truncated(length, tmp_path):
+    index_path = tmp_path / "index.gzi"
+    igzip.build_index(Path(__file__).parent / "data" / "test.fastq.gz",
+                      spacing=100000).save(index_path)
+    index_path.write_bytes(index_path.read_bytes()[:length])
+    with pytest.raises(ValueError, match="Truncated"):
+        igzip.GzipIndex.load(index_path)
+
+
+def test_gzip_index_load_invalid_bit_count(tmp_path):
+    index_path = tmp_path / "index.gzi"
+    igzip.build_index(Path(__file__).parent / "data" / "test.fastq.gz",
+                      spacing=100000).save(index_path)
+    index_data = bytearray(index_path.read_bytes())
+    # The bit count of the first checkpoint follows the magic, the header
+    # and three 64-bit fields.
+    index_data[8 + 16 + 24] = 65
+    index_path.write_bytes(index_data)
+    with pytest.raises(ValueError, match="Invalid checkpoint"):
+        igzip.GzipIndex.load(index_path)
+
+
+def test_decompressor_set_state_invalid():
+    decompressor = igzip_lib.IgzipDecompressor(flag=igzip_lib.DECOMP_DEFLATE)
+    with pytest.raises(ValueError):
+        decompressor._set_state(0, 65, b"", 0)
+    with pytest.raises(ValueError):
+        decompressor._set_state(0, -1, b"", 0)
+    decompressor.decompress(isal_zlib.compress(b"data", wbits=-15))
+    with pytest.raises(ValueError):
+        decompressor._set_state(0, 0, b"", 0)
+
+
+def test_gzip_index_load_not_an_index(tmp_path):
+    index_path = tmp_path / "index.gzi"
+    index_path.write_bytes(b"Not an index")
+    with pytest.raises(ValueError):
+        igzip.GzipIndex.load(index_path)
+
+
+@pytest.mark.parametrize("readahead", [1, 4])
+def test_open_readahead(readahead, tmp_path):
+    path = Path(__file__).parent / "data" / "test.fastq.gz"
+    data = gzip.decompress(path.read_bytes())
+    with igzip.open(path, "rb", readahead=readahead) as gzip_file:
+        assert gzip_file.readline() == data[:data.index(b"\n") + 1]
+        assert gzip_file.read() == data[data.index(b"\n") + 1:]
+        assert gzip_file.mtime is not None
+        gzip_file.seek(1000)
+        assert gzip_file.read(100) == data[1000:1100]
+        gzip_file.seek(500000)
+        assert gzip_file.read(100) == data[500000:500100]
+        gzip_file.seek(-50, io.SEEK_CUR)
+        assert gzip_file.read(100) == data[500050:500150]
+
+
+def test_open_readahead_mtime():
+    first = b"first member" * 1000
+    compressed = (gzip.compress(first, mtime=1) +
+                  gzip.compress(b"second member" * 1000, mtime=2))
+    gzip_file = igzip.IGzipFile(fileobj=io.BytesIO(compressed), readahead=4)
+    with gzip_file:
+        assert gzip_file.read(len(first)) == first
+        # The thread may have read the second member already.
+        assert gzip_file.mtime == 1
+        gzip_file.read()
+        assert gzip_file.mtime == 2
+
+
+def test_open_readahead_close_early():
+    path = Path(__file__).parent / "data" / "test.fastq.gz"
+    with igzip.open(path, "rb", readahead=1) as gzip_file:
+        gzip_file.read(10)
+    assert gzip_file.closed
+
+
+def test_open_readahead_truncated():
+    compressed = igzip.compress(os.urandom(1000000))
+    gzip_file = igzip.IGzipFile(fileobj=io.BytesIO(compressed[:-100]),
+                                readahead=2)
+    with pytest.raises(EOFError):
+        gzip_file.read()
+    with pytest.raises(EOFError):
+        gzip_file.read()
+
+
+def test_open_background(tmp_path):
+    path = tmp_path / "test.gz"
+    data = os.urandom(50000) * 20
+    with igzip.open(path, "wb", background=True) as gzip_file:
+        gzip_file.write(data[:100])
+        gzip_file.write(memoryview(data)[100:300000])
+        buffer = bytearray(data[300000:])
+        gzip_file.write(buffer)
+        # Changing the buffer after write must not change the written data.
+        buffer[:] = bytes(len(buffer))
+        assert gzip_file.tell() == len(data)
+        gzip_file.flush()
+        gzip_file.write(data)
+    assert gzip.decompress(path.read_bytes()) == data + data
+
+
+class FailingFile(io.BytesIO):
+    def write(self, data):
+        if self.tell() > 100:
+            raise OSError("disk full")
+        return super().write(data)
+
+
+def test_open_background_error():
+    fileobj = FailingFile()
+    gzip_file = igzip.open(fileobj, "wb", background=True)
+    with pytest.raises(OSError):
+        for _ in range(100):
+            gzip_file.write(os.urandom(100000))
+    with pytest.raises(OSError):
+        gzip_file.close()
+    assert gzip_file.closed
+
+
+def test_open_background_threads():
+    with pytest.raises(ValueError):
+        igzip.open(io.BytesIO(), "wb", threads=2, background=True)
@@ -18,9 +18,11 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 import gzip
+import io
 import itertools
 import os
 import pickle
+import threading
 import zlib
 from typing import NamedTuple
 
@@ -29,8 +31,8 @@ from isal.igzip_lib import (
     COMP_DEFLATE, COMP_GZIP, COMP_GZIP_NO_HDR, COMP_ZLIB, COMP_ZLIB_NO_HDR,
     DECOMP_DEFLATE, DECOMP_GZIP, DECOMP_GZIP_NO_HDR, DECOMP_GZIP_NO_HDR_VER,
     DECOMP_ZLIB, DECOMP_ZLIB_NO_HDR, DECOMP_ZLIB_NO_HDR_VER, MEM_LEVEL_DEFAULT,
-    MEM_LEVEL_EXTRA_LARGE, MEM_LEVEL_LARGE, MEM_LEVEL_MEDIUM, MEM_LEVEL_MIN,
-    MEM_LEVEL_SMALL)
+    MEM_LEVEL_AUTO, MEM_LEVEL_EXTRA_LARGE, MEM_LEVEL_LARGE, MEM_LEVEL_MEDIUM,
+    MEM_LEVEL_MIN, MEM_LEVEL_SMALL)
 from isal.igzip_lib import IgzipDecompressor
 
 import pytest
@@ -59,7 +61,8 @@ FLAGS = [
     Flag(COMP_GZIP_NO_HDR, DECOMP_GZIP_NO_HDR_VER),
 ]
 MEM_LEVELS = [MEM_LEVEL_DEFAULT, MEM_LEVEL_MIN, MEM_LEVEL_SMALL,
-              MEM_LEVEL_MEDIUM, MEM_LEVEL_LARGE, MEM_LEVEL_EXTRA_LARGE]
+              MEM_LEVEL_MEDIUM, MEM_LEVEL_LARGE, MEM_LEVEL_EXTRA_LARGE,
+              MEM_LEVEL_AUTO]
 
 
 @pytest.mark.parametrize(["level", "flag", "mem_level", "hist_bits"],
@@ -71,6 +74,181 @@ def test_compress_decompress(level, flag, mem_level, hist_bits):
     assert decomp == DATA
 
 
+@pytest.mark.parametrize(["level", "flag", "size"],
+                         itertools.product(COMPRESS_LEVELS, FLAGS,
+                                           [0, 1, 200, 4096, 64 * 1024]))
+def test_compress_decompress_small(level, flag, size):
+    # Small inputs go through the stateless ISA-L functions.
+    data = DATA[:size]
+    comp = igzip_lib.compress(data, level, flag.comp)
+    assert igzip_lib.decompress(comp, flag.decomp) == data
+    # Also when the initial buffer is too small for stateless decompression.
+    assert igzip_lib.decompress(comp, flag.decomp, bufsize=1) == data
+
+
+def test_compress_small_incompressible():
+    data = os.urandom(64 * 1024)
+    comp = igzip_lib.compress(data, flag=COMP_GZIP)
+    assert gzip.decompress(comp) == data
+
+
+def test_decompress_small_truncated():
+    comp = igzip_lib.compress(DATA[:4096])
+    with pytest.raises(igzip_lib.IsalError) as error:
+        igzip_lib.decompress(comp[:-10])
+    error.match("incomplete or truncated stream")
+
+
+@pytest.mark.parametrize("bufsize", [0, 1, 1024, len(DATA), 10 * len(DATA)])
+def test_decompress_gzip_bufsize(bufsize):
+    assert igzip_lib.decompress(GZIP_COMPRESSED, DECOMP_GZIP,
+                                bufsize=bufsize) == DATA
+
+
+@pytest.mark.parametrize("trailing", [b"\x00" * 4, b"\xff" * 4, b"garbage"])
+def test_decompress_gzip_wrong_size_hint(trailing):
+    # The gzip trailer size is only used as a hint. Trailing data that makes
+    # the hint wrong should not affect the result.
+    assert igzip_lib.decompress(GZIP_COMPRESSED + trailing,
+                                DECOMP_GZIP) == DATA
+
+
+def test_compress_level_buffer_reuse():
+    # Level buffers are cached between calls. Alternating between levels,
+    # and thus buffer sizes, must not affect the results.
+    for level in COMPRESS_LEVELS * 2:
+        for flag in FLAGS[:3]:
+            comp = igzip_lib.compress(DATA, level, flag.comp)
+            assert igzip_lib.decompress(comp, flag.decomp) == DATA
+
+
+def test_compress_level_buffer_cached():
+    igzip_lib.compress(DATA, 3)
+    cached = igzip_lib._level_buf_cache.buffer
+    assert isinstance(cached, bytearray)
+    # The largest buffer is kept and used for smaller levels as well.
+    for level in COMPRESS_LEVELS:
+        igzip_lib.compress(DATA[:100], level)
+        assert igzip_lib._level_buf_cache.buffer is cached
+
+
+def test_compress_decompress_threaded():
+    # Each thread works on its own independent data. Since the GIL is released
+    # during compression and decompression the streams must not interfere.
+    blocks = [DATA[i * 1024:] for i in range(8)]
+    results = [None] * len(blocks)
+
+    def roundtrip(index):
+        compressed = igzip_lib.compress(blocks[index], flag=COMP_GZIP)
+        results[index] = igzip_lib.decompress(compressed, flag=DECOMP_GZIP)
+
+    threads = [threading.Thread(target=roundtrip, args=(i,))
+               for i in range(len(blocks))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert results == blocks
+
+
+@pytest.mark.parametrize(["level", "flag"],
+                         itertools.product(COMPRESS_LEVELS, FLAGS))
+def test_compress_decompress_into(level, flag):
+    out = bytearray(len(DATA) + 1024)
+    written = igzip_lib.compress_into(DATA, out, level, flag.comp)
+    assert out[:written] == igzip_lib.compress(DATA, level, flag.comp)
+    result = bytearray(len(DATA))
+    written = igzip_lib.decompress_into(memoryview(out)[:written], result,
+                                        flag.decomp)
+    assert written == len(DATA)
+    assert result == DATA
+
+
+def test_compress_into_too_small():
+    out = bytearray(100)
+    with pytest.raises(igzip_lib.IsalError):
+        igzip_lib.compress_into(os.urandom(1000), out)
+
+
+def test_decompress_into_too_small():
+    compressed = igzip_lib.compress(DATA)
+    with pytest.raises(igzip_lib.IsalError):
+        igzip_lib.decompress_into(compressed, bytearray(len(DATA) - 1))
+
+
+def test_decompress_into_read_only():
+    with pytest.raises(TypeError):
+        igzip_lib.decompress_into(igzip_lib.compress(DATA), bytes(len(DATA)))
+
+
+@pytest.mark.parametrize(["level", "flag"],
+                         itertools.product(COMPRESS_LEVELS, FLAGS))
+def test_compressor_decompressor_reuse(level, flag):
+    compressor = igzip_lib.Compressor(level, flag.comp)
+    decompressor = igzip_lib.Decompressor(flag.decomp)
+    for size in (0, 100, 4096, 100000, len(DATA)):
+        data = DATA[:size]
+        compressed = compressor.compress(data)
+        assert compressed == igzip_lib.compress(data, level, flag.comp)
+        assert decompressor.decompress(compressed) == data
+
+
+def test_decompressor_reuse_after_error():
+    decompressor = igzip_lib.Decompressor()
+    with pytest.raises(igzip_lib.IsalError):
+        decompressor.decompress(b"Not a valid deflate block" * 10)
+    decompressor.reset()
+    assert decompressor.decompress(igzip_lib.compress(DATA)) == DATA
+
+
+def test_compressor_invalid_mem_level():
+    with pytest.raises(ValueError):
+        igzip_lib.Compressor(mem_level=42)
+
+
+def test_compress_invalid_mem_level():
+    with pytest.raises(ValueError):
+        igzip_lib.compress(DATA, mem_level=42)
+    with pytest.raises(ValueError):
+        igzip_lib.compress_into(DATA, bytearray(len(DATA)), mem_level=42)
+
+
+@pytest.mark.parametrize("size", [0, 1000, 10000, 30000, 60000, 100000])
+def test_compress_mem_level_auto(size):
+    data = RAW_DATA[:size]
+    compressed = igzip_lib.compress(data, mem_level=MEM_LEVEL_AUTO)
+    assert igzip_lib.decompress(compressed) == data
+
+
+@pytest.mark.parametrize("flag", FLAGS)
+def test_compress_hufftables(flag):
+    tables = igzip_lib.train_hufftables([DATA[:64 * 1024], DATA[64 * 1024:]])
+    compressed = igzip_lib.compress(DATA, 0, flag.comp, hufftables=tables)
+    assert igzip_lib.decompress(compressed, flag.decomp) == DATA
+    assert len(compressed) <= len(igzip_lib.compress(DATA, 0, flag.comp))
+    compressor = igzip_lib.Compressor(0, flag.comp, hufftables=tables)
+    assert compressor.compress(DATA) == compressed
+
+
+def test_hufftables_serialization():
+    tables = igzip_lib.train_hufftables(DATA)
+    restored = igzip_lib.HuffTables.from_bytes(tables.to_bytes())
+    assert restored.to_bytes() == tables.to_bytes()
+    unpickled = pickle.loads(pickle.dumps(tables))
+    assert (igzip_lib.compress(DATA, 0, hufftables=unpickled) ==
+            igzip_lib.compress(DATA, 0, hufftables=tables))
+
+
+def test_hufftables_from_invalid_bytes():
+    with pytest.raises(ValueError):
+        igzip_lib.HuffTables.from_bytes(b"Not huffman tables")
+
+
+def test_compress_hufftables_wrong_type():
+    with pytest.raises(TypeError):
+        igzip_lib.compress(DATA, 0, hufftables=b"Not huffman tables")
+
+
 class TestIgzipDecompressor():
     # Tests adopted from CPython's test_bz2.py
     TEXT = DATA
@@ -82,6 +260,18 @@ class TestIgzipDecompressor():
         decompressed = decomp.decompress(self.DATA)
         assert decompressed == self.TEXT
 
+    def test_decompress_into(self):
+        decomp = IgzipDecompressor()
+        out = bytearray(1000)
+        text = b""
+        data = self.DATA
+        while not decomp.eof:
+            written = decomp.decompress_into(data, out)
+            assert written <= len(out)
+            text += out[:written]
+            data = b""
+        assert text == self.TEXT
+
     def testDecompressChunks10(self):
         igzd = IgzipDecompressor()
         text = b''
@@ -252,3 +442,177 @@ def test_igzip_decompressor_raw_deflate_unused_data_gzip(test_offset):
     igzd.decompress(raw_deflate_incomplete_trailer)
     if igzd.eof:
         assert igzd.unused_data == true_unused_data
+
+
+
+def read_all(reader, buffer_size=3000):
+    result = bytearray()
+    buffer = bytearray(buffer_size)
+    while True:
+        written = reader.readinto(buffer)
+        if not written:
+            return bytes(result)
+        result += buffer[:written]
+
+
+@pytest.mark.parametrize("buffersize", [8, 13, 1024, 128 * 1024])
+def test_gzip_reader(buffersize):
+    # Members with zero padding in between.
+    first = gzip.compress(DATA[:50000], mtime=1)
+    second = igzip_lib.compress(DATA[50000:], flag=COMP_GZIP)
+    fileobj = io.BytesIO(first + b"\x00" * 20 + second)
+    reader = igzip_lib.GzipReader(fileobj, buffersize)
+    assert reader.mtime is None
+    assert read_all(reader) == DATA
+    assert reader.tell() == len(DATA)
+    reader.rewind()
+    assert reader.tell() == 0
+    assert reader.readinto(bytearray(10)) == 10
+    assert reader.mtime == 1
+
+
+class OneByteReader(io.RawIOBase):
+    """A raw file object that returns at most one byte per read."""
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def readable(self):
+        return True
+
+    def readinto(self, b):
+        data = self.data[self.pos:self.pos + 1]
+        b[:len(data)] = data
+        self.pos += len(data)
+        return len(data)
+
+
+def test_gzip_reader_one_byte_reads():
+    # The trailers straddle many short reads.
+    data = DATA[:20000]
+    compressed = gzip.compress(data[:10000]) + gzip.compress(data[10000:])
+    reader = igzip_lib.GzipReader(OneByteReader(compressed), 8)
+    assert read_all(reader) == data
+
+
+def test_gzip_reader_truncated():
+    reader = igzip_lib.GzipReader(io.BytesIO(GZIP_COMPRESSED[:-4]))
+    with pytest.raises(EOFError):
+        read_all(reader)
+
+
+def test_gzip_reader_wrong_crc():
+    corrupted = GZIP_COMPRESSED[:-8] + b"\x00\x00\x00\x00" + \
+        GZIP_COMPRESSED[-4:]
+    reader = igzip_lib.GzipReader(io.BytesIO(corrupted))
+    with pytest.raises(igzip_lib.BadGzipFile):
+        read_all(reader)
+
+
+def test_igzip_compressor_gzip_no_hdr():
+    compressor = igzip_lib.IgzipCompressor(flag=COMP_GZIP_NO_HDR)
+    compressed = b"".join([
+        compressor.compress(DATA[:1000]),
+        compressor.flush(igzip_lib.ISAL_SYNC_FLUSH),
+        compressor.compress(DATA[1000:]),
+        compressor.finish()])
+    header = gzip.compress(b"")[:10]
+    assert gzip.decompress(header + compressed) == DATA
+    with pytest.raises(ValueError):
+        compressor.compress(DATA)
+
+
+def test_igzip_compressor_flush_mode():
+    compressor = igzip_lib.IgzipCompressor()
+    with pytest.raises(ValueError):
+        compressor.flush(igzip_lib.ISAL_NO_FLUSH)
+
+
+@pytest.mark.parametrize("level", range(4))
+def test_compress_gzip(level):
+    compressed = igzip_lib.compress_gzip(DATA, level, mtime=1234567890,
+                                         name=b"test.fastq",
+                                         extra=b"AB\x02\x00xy")
+    assert compressed[:4] == b"\x1f\x8b\x08\x0c"
+    assert compressed[4:8] == (1234567890).to_bytes(4, "little")
+    assert compressed[8] == (4 if level == 0 else 0)
+    assert compressed[9] == 255
+    assert compressed[10:18] == b"\x06\x00AB\x02\x00xy"
+    assert compressed[18:29] == b"test.fastq\x00"
+    assert gzip.decompress(compressed) == DATA
+
+
+def test_compress_gzip_defaults():
+    compressed = igzip_lib.compress_gzip(b"")
+    assert compressed[:4] == b"\x1f\x8b\x08\x00"
+    assert len(compressed) > 10 + 8
+    assert gzip.decompress(compressed) == b""
+
+
+def test_compress_gzip_invalid_name():
+    with pytest.raises(ValueError):
+        igzip_lib.compress_gzip(b"data", name=b"a\x00b")
+
+
+def test_decompress_gzip_many_members():
+    members = [gzip.compress(DATA[i:i + 1000]) for i in range(0, 100000, 1000)]
+    # Zero padding between members is skipped.
+    compressed = b"\x00\x00".join(members) + b"\x00"
+    assert igzip_lib.decompress_gzip(compressed) == DATA[:100000]
+    assert igzip_lib.decompress_gzip(memoryview(compressed)) == DATA[:100000]
+
+
+def test_decompress_gzip_truncated_member():
+    compressed = gzip.compress(DATA) * 2
+    with pytest.raises(EOFError):
+        igzip_lib.decompress_gzip(compressed[:-20])
+
+
+def test_decompress_gzip_wrong_crc():
+    compressed = bytearray(gzip.compress(DATA) * 2)
+    compressed[-8] ^= 0xFF
+    with pytest.raises(igzip_lib.BadGzipFile):
+        igzip_lib.decompress_gzip(compressed)
+
+
+@pytest.mark.parametrize(["flag", "threads"],
+                         itertools.product(FLAGS, [1, 3]))
+def test_compress_decompress_many(flag, threads):
+    buffers = [DATA[i:i * 3] for i in range(0, 50000, 2999)] + [b""]
+    compressed = igzip_lib.compress_many(buffers, 1, flag.comp,
+                                         threads=threads)
+    assert compressed == [igzip_lib.compress(data, 1, flag.comp)
+                          for data in buffers]
+    assert [igzip_lib.decompress(data, flag.decomp)
+            for data in compressed] == buffers
+    assert igzip_lib.decompress_many(compressed, flag.decomp,
+                                     threads=threads) == buffers
+
+
+def test_decompress_many_small_bufsize():
+    buffers = [DATA[:1000], DATA[:100000], DATA[5:6]]
+    compressed = [igzip_lib.compress(buffer) for buffer in buffers]
+    assert igzip_lib.decompress_many(compressed, bufsize=10) == buffers
+
+
+def test_decompress_many_error():
+    compressed = [igzip_lib.compress(DATA[:1000]), b"Not a deflate block"]
+    with pytest.raises(igzip_lib.IsalError):
+        igzip_lib.decompress_many(compressed)
+
+
+@pytest.mark.parametrize(["flag", "mem_level"],
+                         itertools.product(FLAGS, [MEM_LEVEL_DEFAULT,
+                                                   MEM_LEVEL_AUTO]))
+def test_compress_iov(flag, mem_level):
+    fragments = [DATA[i:i + 7000] for i in range(0, len(DATA), 7000)]
+    compressed = igzip_lib.compress_iov(fragments, flag=flag.comp,
+                                        mem_level=mem_level)
+    assert igzip_lib.decompress(compressed, flag.decomp) == DATA
+    assert igzip_lib.decompress(igzip_lib.compress_iov([], flag=flag.comp),
+                                flag.decomp) == b""
+    chunks = igzip_lib.compress_iov(fragments, flag=flag.comp,
+                                    mem_level=mem_level, chunks=True)
+    assert isinstance(chunks, list)
+    assert all(chunks)
+    assert b"".join(chunks) == compressed